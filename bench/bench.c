@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "bench.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_MIN_NS    20000000ull  // calibration run length
+#define BENCH_TARGET_NS 200000000ull // measured run length
+
+static FILE *bench_out;
+static uint64_t out_bytes;
+
+static void bench_write(const char *str, uint16_t len, void *priv) {
+    (void) str;
+    (void) priv;
+    out_bytes += len;
+}
+
+static uint32_t bench_get_tick(void) {
+    return (uint32_t) (bench_now_ns() / 1000000ull);
+}
+
+uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t bench_out_bytes(void) {
+    return out_bytes;
+}
+
+void bench_setup(ctshell_ctx_t *ctx, int argc, char *argv[]) {
+    bench_out = stdout;
+    if (argc > 1) {
+        bench_out = fopen(argv[1], "a");
+        if (!bench_out) {
+            perror(argv[1]);
+            bench_out = stdout;
+        }
+    }
+
+    ctshell_io_t io = {
+            .write = bench_write,
+            .get_tick = bench_get_tick,
+    };
+    ctshell_init(ctx, io, NULL);
+}
+
+void bench_teardown(void) {
+    if (bench_out && bench_out != stdout) {
+        fclose(bench_out);
+    }
+    bench_out = NULL;
+}
+
+double bench_measure(ctshell_ctx_t *ctx, bench_fn_t fn, uint64_t *iters) {
+    uint64_t n = 1;
+    uint64_t elapsed;
+
+    for (;;) {
+        uint64_t t0 = bench_now_ns();
+        fn(ctx, n);
+        elapsed = bench_now_ns() - t0;
+        if (elapsed >= BENCH_MIN_NS) break;
+        n *= 2;
+    }
+
+    n = (uint64_t) ((double) n * BENCH_TARGET_NS / (double) elapsed) + 1;
+    uint64_t t0 = bench_now_ns();
+    fn(ctx, n);
+    elapsed = bench_now_ns() - t0;
+
+    if (iters) *iters = n;
+    return (double) elapsed / (double) n;
+}
+
+void bench_report(const char *suite, const char *bench, double value, const char *unit,
+                  uint64_t iters, int commands) {
+    fprintf(bench_out,
+            "{\"suite\":\"%s\",\"bench\":\"%s\",\"value\":%.3f,\"unit\":\"%s\",\"iters\":%llu,\"commands\":%d}\n",
+            suite, bench, value, unit, (unsigned long long) iters, commands);
+    fflush(bench_out);
+}
+
+void bench_feed(ctshell_ctx_t *ctx, const char *s) {
+    ctshell_input_buf(ctx, s, (uint16_t) strlen(s));
+    ctshell_poll(ctx);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include "ctshell.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* runs the measured operation `iters` times */
+typedef void (*bench_fn_t)(ctshell_ctx_t *ctx, uint64_t iters);
+
+/*
+ * Opens the result file (argv[1], appended) or stdout and initializes `ctx`
+ * with an in-memory loopback io that counts and discards all output.
+ */
+void bench_setup(ctshell_ctx_t *ctx, int argc, char *argv[]);
+void bench_teardown(void);
+
+uint64_t bench_now_ns(void);
+uint64_t bench_out_bytes(void);
+
+/* calibrates the iteration count, returns nanoseconds per iteration */
+double bench_measure(ctshell_ctx_t *ctx, bench_fn_t fn, uint64_t *iters);
+
+/* writes one JSON line: {"suite":..,"bench":..,"value":..,"unit":..,"iters":..,"commands":..} */
+void bench_report(const char *suite, const char *bench, double value, const char *unit,
+                  uint64_t iters, int commands);
+
+/* feeds a whole string and polls once */
+void bench_feed(ctshell_ctx_t *ctx, const char *s);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Input path, line editing, variable expansion and printf throughput.
+ *
+ *   bench_core [results.jsonl]
+ */
+#include "bench.h"
+
+#include <stdio.h>
+
+#define EDIT_LINE_LEN 60
+
+static ctshell_ctx_t ctx;
+
+/* 8 printable bytes followed by 8 backspaces, the line ends up empty again */
+static const char type_erase[] = "abcdefgh\x7f\x7f\x7f\x7f\x7f\x7f\x7f\x7f";
+
+static void run_input_byte(ctshell_ctx_t *c, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        ctshell_input(c, type_erase[i & 15]);
+        ctshell_poll(c);
+    }
+}
+
+static void run_input_buf(ctshell_ctx_t *c, uint64_t iters) {
+    char chunk[64];
+    for (int i = 0; i < (int) sizeof(chunk); i++) {
+        chunk[i] = type_erase[i & 15];
+    }
+    for (uint64_t i = 0; i < iters; i++) {
+        ctshell_input_buf(c, chunk, sizeof(chunk));
+        ctshell_poll(c);
+    }
+}
+
+/* insert and erase one character in the middle of a long line */
+static void run_edit_midline(ctshell_ctx_t *c, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        ctshell_input(c, 'y');
+        ctshell_input(c, 0x7f);
+        ctshell_poll(c);
+    }
+}
+
+static void run_echo_literal(ctshell_ctx_t *c, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        bench_feed(c, "echo v0 v1 v2 v3 v4 v5 v6 v7\r");
+    }
+}
+
+static void run_echo_vars(ctshell_ctx_t *c, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        bench_feed(c, "echo $a0 $a1 $a2 $a3 $a4 $a5 $a6 $a7\r");
+    }
+}
+
+static void run_printf(ctshell_ctx_t *c, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        ctshell_printf("%-8s %5d 0x%08x %c|\r\n", "bench", (int) i, (unsigned) i, 'x');
+    }
+    ctshell_flush(c);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t iters, bytes;
+    double ns;
+
+    bench_setup(&ctx, argc, argv);
+    ctshell_poll(&ctx);
+
+    ns = bench_measure(&ctx, run_input_byte, &iters);
+    bench_report("core", "input_poll_byte", ns, "ns/byte", iters, 0);
+
+    ns = bench_measure(&ctx, run_input_buf, &iters);
+    bench_report("core", "input_buf_poll_64", ns / 64, "ns/byte", iters * 64, 0);
+
+    for (int i = 0; i < EDIT_LINE_LEN; i++) {
+        ctshell_input(&ctx, 'x');
+    }
+    for (int i = 0; i < EDIT_LINE_LEN / 2; i++) {
+        ctshell_input_buf(&ctx, "\x1b[D", 3);
+    }
+    ctshell_poll(&ctx);
+    ns = bench_measure(&ctx, run_edit_midline, &iters);
+    bench_report("core", "edit_midline_key", ns / 2, "ns/key", iters * 2, 0);
+    bytes = bench_out_bytes();
+    run_edit_midline(&ctx, 1000);
+    bench_report("core", "edit_midline_output", (double) (bench_out_bytes() - bytes) / 2000, "bytes/key", 2000, 0);
+    bench_feed(&ctx, "\x03");
+
+    for (int i = 0; i < 8; i++) {
+        char line[32];
+        snprintf(line, sizeof(line), "set a%d v%d\r", i, i);
+        bench_feed(&ctx, line);
+    }
+    ns = bench_measure(&ctx, run_echo_literal, &iters);
+    bench_report("core", "exec_echo_literal", ns, "ns/line", iters, 0);
+    ns = bench_measure(&ctx, run_echo_vars, &iters);
+    bench_report("core", "exec_echo_8_vars", ns, "ns/line", iters, 0);
+
+    // the same lookups with the variable table nearly full
+    for (int i = 8; i < CONFIG_CTSHELL_VAR_MAX_COUNT; i++) {
+        char line[32];
+        snprintf(line, sizeof(line), "set b%d v%d\r", i, i);
+        bench_feed(&ctx, line);
+    }
+    ns = bench_measure(&ctx, run_echo_vars, &iters);
+    bench_report("core", "exec_echo_8_vars_full", ns, "ns/line", iters, 0);
+
+    ns = bench_measure(&ctx, run_printf, &iters);
+    bench_report("core", "printf_call", ns, "ns/call", iters, 0);
+    bytes = bench_out_bytes();
+    run_printf(&ctx, 1000);
+    bytes = bench_out_bytes() - bytes;
+    bench_report("core", "printf_throughput", (double) bytes / 1000 / ns * 1e3, "MB/s", iters, 0);
+
+    bench_teardown();
+    return 0;
+}
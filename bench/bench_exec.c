@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Command dispatch and tab completion against BENCH_NCMDS synthetic commands
+ * named cmd_0000, cmd_0001, ... The build produces one executable per size.
+ *
+ *   bench_exec_1000 [results.jsonl]
+ */
+#include "bench.h"
+
+#include <stdio.h>
+
+#ifndef BENCH_NCMDS
+#define BENCH_NCMDS 100
+#endif
+
+static int bench_nop(int argc, char *argv[]) {
+    (void) argc;
+    (void) argv;
+    return 0;
+}
+
+#define BENCH_CMD_(id)       CTSHELL_EXPORT_CMD(id, bench_nop, "synthetic", CTSHELL_ATTR_NONE);
+#define BENCH_CMD(a, b, c, d) BENCH_CMD_(cmd_##a##b##c##d)
+
+#define D0(a, b, c) \
+    BENCH_CMD(a, b, c, 0) BENCH_CMD(a, b, c, 1) BENCH_CMD(a, b, c, 2) BENCH_CMD(a, b, c, 3) BENCH_CMD(a, b, c, 4) \
+    BENCH_CMD(a, b, c, 5) BENCH_CMD(a, b, c, 6) BENCH_CMD(a, b, c, 7) BENCH_CMD(a, b, c, 8) BENCH_CMD(a, b, c, 9)
+#define D1(a, b) \
+    D0(a, b, 0) D0(a, b, 1) D0(a, b, 2) D0(a, b, 3) D0(a, b, 4) \
+    D0(a, b, 5) D0(a, b, 6) D0(a, b, 7) D0(a, b, 8) D0(a, b, 9)
+#define D2(a) \
+    D1(a, 0) D1(a, 1) D1(a, 2) D1(a, 3) D1(a, 4) \
+    D1(a, 5) D1(a, 6) D1(a, 7) D1(a, 8) D1(a, 9)
+#define D3() \
+    D2(0) D2(1) D2(2) D2(3) D2(4) \
+    D2(5) D2(6) D2(7) D2(8) D2(9)
+
+#if BENCH_NCMDS == 10
+D0(0, 0, 0)
+#elif BENCH_NCMDS == 100
+D1(0, 0)
+#elif BENCH_NCMDS == 1000
+D2(0)
+#elif BENCH_NCMDS == 10000
+D3()
+#else
+#error "BENCH_NCMDS must be 10, 100, 1000 or 10000"
+#endif
+
+static ctshell_ctx_t ctx;
+static char exec_hit[32];
+static char complete_unique[32];
+
+static void run_exec_hit(ctshell_ctx_t *c, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        bench_feed(c, exec_hit);
+    }
+}
+
+static void run_exec_miss(ctshell_ctx_t *c, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        bench_feed(c, "cmd_x\r");
+    }
+}
+
+/* the typed prefix matches one command, Ctrl+C discards the completed line */
+static void run_complete_unique(ctshell_ctx_t *c, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        bench_feed(c, complete_unique);
+    }
+}
+
+/* every synthetic command matches, the line is extended or the matches are listed */
+static void run_complete_prefix(ctshell_ctx_t *c, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        bench_feed(c, "cmd_\t\x03");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t iters;
+    double ns;
+
+    // the last command sorts last, so a linear scan would visit every entry
+    snprintf(exec_hit, sizeof(exec_hit), "cmd_%04d\r", BENCH_NCMDS - 1);
+    snprintf(complete_unique, sizeof(complete_unique), "cmd_%04d\t\x03", BENCH_NCMDS - 1);
+
+    bench_setup(&ctx, argc, argv);
+    ctshell_poll(&ctx);
+
+    ns = bench_measure(&ctx, run_exec_hit, &iters);
+    bench_report("exec", "exec_hit", ns, "ns/line", iters, BENCH_NCMDS);
+
+    ns = bench_measure(&ctx, run_exec_miss, &iters);
+    bench_report("exec", "exec_miss", ns, "ns/line", iters, BENCH_NCMDS);
+
+    ns = bench_measure(&ctx, run_complete_unique, &iters);
+    bench_report("exec", "complete_unique", ns, "ns/op", iters, BENCH_NCMDS);
+
+    ns = bench_measure(&ctx, run_complete_prefix, &iters);
+    bench_report("exec", "complete_prefix", ns, "ns/op", iters, BENCH_NCMDS);
+
+    bench_teardown();
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * The same command run as a text line and as an RPC request, per request
+ * time and bytes on the wire in both directions.
+ *
+ *   bench_rpc [results.jsonl]
+ */
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static ctshell_ctx_t ctx;
+
+static const char text_line[] = "echo a b c\r";
+static const char call_args[] = "echo\0a\0b\0c"; // sizeof includes the last terminator
+
+static char frame[64];
+static int frame_len;
+static char reply[256];
+static int reply_len;
+
+static uint16_t crc16(const uint8_t *p, int len) {
+    uint16_t crc = 0xFFFF;
+    while (len-- > 0) {
+        crc ^= (uint16_t) (*p++ << 8);
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (uint16_t) (crc << 1) ^ 0x1021 : (uint16_t) (crc << 1);
+        }
+    }
+    return crc;
+}
+
+/* COBS encodes raw[0, len) plus its CRC into `frame`, delimiter included */
+static void build_frame(uint8_t *raw, int len) {
+    uint16_t crc = crc16(raw, len);
+    raw[len++] = (uint8_t) crc;
+    raw[len++] = (uint8_t) (crc >> 8);
+
+    int code_at = frame_len++;
+    uint8_t code = 1;
+    for (int i = 0; i < len; i++) {
+        if (raw[i] != 0) {
+            frame[frame_len++] = (char) raw[i];
+            code++;
+        }
+        if (raw[i] == 0 || code == 0xFF) {
+            frame[code_at] = (char) code;
+            code_at = frame_len++;
+            code = 1;
+        }
+    }
+    frame[code_at] = (char) code;
+    frame[frame_len++] = 0;
+}
+
+static void run_text(ctshell_ctx_t *c, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        ctshell_input_buf(c, text_line, sizeof(text_line) - 1);
+        ctshell_poll(c);
+    }
+}
+
+static void run_rpc(ctshell_ctx_t *c, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        ctshell_input_buf(c, frame, (uint16_t) frame_len);
+        ctshell_poll(c);
+    }
+}
+
+static void reply_write(const char *str, uint16_t len, void *priv) {
+    (void) priv;
+    if (len > sizeof(reply) - reply_len) len = (uint16_t) (sizeof(reply) - reply_len);
+    memcpy(&reply[reply_len], str, len);
+    reply_len += len;
+}
+
+/* runs the request once, its last packet must be a DONE with rc 0 and a good CRC */
+static int check_rpc(ctshell_ctx_t *c) {
+    ctshell_io_t io = c->io;
+    c->io.write = reply_write;
+    run_rpc(c, 1);
+    c->io = io;
+    if (reply_len == 0 || reply[reply_len - 1] != 0) return -1;
+
+    int start = reply_len - 1;
+    while (start > 0 && reply[start - 1] != 0) start--;
+    uint8_t raw[sizeof(reply)];
+    int len = 0;
+    for (int i = start; i < reply_len - 1;) {
+        uint8_t code = (uint8_t) reply[i++];
+        if (code == 0 || i + code - 1 > reply_len - 1) return -1;
+        for (int k = 1; k < code; k++) raw[len++] = (uint8_t) reply[i++];
+        if (code != 0xFF && i < reply_len - 1) raw[len++] = 0;
+    }
+    if (len != 9 || crc16(raw, 7) != (uint16_t) (raw[7] | raw[8] << 8)) return -1;
+    if (raw[0] != CTSHELL_RPC_DONE || raw[1] != 1 || raw[2] != 0) return -1;
+    return (raw[3] | raw[4] | raw[5] | raw[6]) == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t iters, bytes;
+    double ns;
+    uint8_t raw[64] = {CTSHELL_RPC_CALL_NAME, 1, 0};
+
+    memcpy(&raw[3], call_args, sizeof(call_args));
+    build_frame(raw, 3 + (int) sizeof(call_args));
+
+    bench_setup(&ctx, argc, argv);
+    ctshell_poll(&ctx);
+
+    ns = bench_measure(&ctx, run_text, &iters);
+    bench_report("rpc", "text_line", ns, "ns/request", iters, 0);
+    bytes = bench_out_bytes();
+    run_text(&ctx, 1000);
+    bench_report("rpc", "text_line_rx", (double) (bench_out_bytes() - bytes) / 1000, "bytes/request", 1000, 0);
+    bench_report("rpc", "text_line_tx", sizeof(text_line) - 1, "bytes/request", 1000, 0);
+
+    // switches the link to packets
+    ctshell_input_buf(&ctx, "rpc\r", 4);
+    ctshell_poll(&ctx);
+    if (check_rpc(&ctx) < 0) {
+        fprintf(stderr, "bench_rpc: the request is not answered with DONE\n");
+        bench_teardown();
+        return 1;
+    }
+    ns = bench_measure(&ctx, run_rpc, &iters);
+    bench_report("rpc", "rpc_call_name", ns, "ns/request", iters, 0);
+    bytes = bench_out_bytes();
+    run_rpc(&ctx, 1000);
+    bench_report("rpc", "rpc_call_name_rx", (double) (bench_out_bytes() - bytes) / 1000, "bytes/request", 1000, 0);
+    bench_report("rpc", "rpc_call_name_tx", frame_len, "bytes/request", 1000, 0);
+
+    bench_teardown();
+    return 0;
+}
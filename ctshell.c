@@ -4,7 +4,6 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include "ctshell.h"
-#include <stdio.h>
 #include <stdarg.h>
 #include <ctype.h>
 #include <stdlib.h>
@@ -22,141 +21,1102 @@ extern const ctshell_cmd_t __stop_ctshell_cmd_section;
 #define CMD_END   (&__stop_ctshell_cmd_section)
 #endif
 
+#if (CONFIG_CTSHELL_FIFO_SIZE & (CONFIG_CTSHELL_FIFO_SIZE - 1)) != 0
+#error "CONFIG_CTSHELL_FIFO_SIZE must be a power of two"
+#endif
+#define FIFO_MASK (CONFIG_CTSHELL_FIFO_SIZE - 1)
+
+#if CONFIG_CTSHELL_VAR_MAX_COUNT < 1 || (CONFIG_CTSHELL_VAR_MAX_COUNT & (CONFIG_CTSHELL_VAR_MAX_COUNT - 1)) != 0
+#error "CONFIG_CTSHELL_VAR_MAX_COUNT must be a power of two"
+#endif
+#if CONFIG_CTSHELL_VAR_ARENA_SIZE > UINT16_MAX
+#error "CONFIG_CTSHELL_VAR_ARENA_SIZE must not exceed 65535"
+#endif
+#define VAR_INDEX_MASK (CTSHELL_VAR_INDEX_SIZE - 1)
+
+/*
+ * The input FIFO is shared between one producer (ctshell_input, usually an
+ * ISR or RX thread) and one consumer (ctshell_poll); the command index is
+ * shared by every shell. The __atomic builtins give C11 acquire/release
+ * semantics on plain fields, which keeps ctshell.h usable from C++ and from
+ * compilers without <stdatomic.h>.
+ */
+#if defined(__ATOMIC_ACQUIRE)
+#define SHARED_LOAD_RELAXED(p)     __atomic_load_n((p), __ATOMIC_RELAXED)
+#define SHARED_LOAD_ACQUIRE(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define SHARED_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+// single-core targets only: volatile accesses fenced by compiler barriers
+#if defined(__CC_ARM)
+#define SHARED_BARRIER() __schedule_barrier()
+#else
+#define SHARED_BARRIER() __asm volatile("" ::: "memory")
+#endif
+#define SHARED_LOAD_RELAXED(p)     (*(volatile uint32_t *) (p))
+#define SHARED_LOAD_ACQUIRE(p)     ctshell_shared_load_acquire(p)
+#define SHARED_STORE_RELEASE(p, v) do { SHARED_BARRIER(); *(volatile uint32_t *) (p) = (v); } while (0)
+
+static inline uint32_t ctshell_shared_load_acquire(uint32_t *p) {
+    uint32_t v = *(volatile uint32_t *) p;
+    SHARED_BARRIER();
+    return v;
+}
+#endif
+
+#if defined(CONFIG_CTSHELL_USE_TLS)
+#define CTSHELL_THREAD_LOCAL __thread
+#else
+#define CTSHELL_THREAD_LOCAL
+#endif
+
+/*
+ * The shell whose input is being handled, set by ctshell_poll. With
+ * CONFIG_CTSHELL_USE_TLS each thread has its own, so shells polled from
+ * different threads never see each other.
+ */
+static CTSHELL_THREAD_LOCAL ctshell_ctx_t *g_ctshell_cur;
+/* last initialized shell, the fallback outside of ctshell_poll until its ctshell_deinit */
 static ctshell_ctx_t *g_ctshell_ctx = NULL;
 
-static const ctshell_dfa_trans_t dfa_table[] = {
-        {CTSHELL_DFA_ROOT, CTSHELL_KEY_ENTER,      CTSHELL_DFA_ROOT, CTSHELL_EVT_ENTER},
-        {CTSHELL_DFA_ROOT, CTSHELL_KEY_LF,         CTSHELL_DFA_ROOT, CTSHELL_EVT_ENTER},
-        {CTSHELL_DFA_ROOT, CTSHELL_KEY_BACKSPACE,  CTSHELL_DFA_ROOT, CTSHELL_EVT_BACKSPACE},
-        {CTSHELL_DFA_ROOT, CTSHELL_KEY_BACKSPACE2, CTSHELL_DFA_ROOT, CTSHELL_EVT_BACKSPACE},
-        {CTSHELL_DFA_ROOT, CTSHELL_KEY_TAB,        CTSHELL_DFA_ROOT, CTSHELL_EVT_TAB},
-        {CTSHELL_DFA_ROOT, CTSHELL_KEY_CTRL_C,     CTSHELL_DFA_ROOT, CTSHELL_EVT_CTRL_C},
-        {CTSHELL_DFA_ROOT, CTSHELL_KEY_ESC,        CTSHELL_DFA_ESC,  CTSHELL_EVT_NONE},
-        {CTSHELL_DFA_ESC, '[',                     CTSHELL_DFA_CSI,  CTSHELL_EVT_NONE},
-        {CTSHELL_DFA_CSI, 'A',                     CTSHELL_DFA_ROOT, CTSHELL_EVT_UP},
-        {CTSHELL_DFA_CSI, 'B',                     CTSHELL_DFA_ROOT, CTSHELL_EVT_DOWN},
-        {CTSHELL_DFA_CSI, 'C',                     CTSHELL_DFA_ROOT, CTSHELL_EVT_RIGHT},
-        {CTSHELL_DFA_CSI, 'D',                     CTSHELL_DFA_ROOT, CTSHELL_EVT_LEFT},
+/* a command owns the terminal, Ctrl+C only raises ctx->sigint */
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+#define CTSHELL_BUSY(ctx) ((ctx)->is_executing || (ctx)->fg)
+#else
+#define CTSHELL_BUSY(ctx) ((ctx)->is_executing)
+#endif
+
+#if defined(__ATOMIC_ACQUIRE)
+#define DEFAULT_CTX_LOAD()     __atomic_load_n(&g_ctshell_ctx, __ATOMIC_ACQUIRE)
+#define DEFAULT_CTX_STORE(ctx) __atomic_store_n(&g_ctshell_ctx, (ctx), __ATOMIC_RELEASE)
+#define DEFAULT_CTX_CLEAR(ctx) \
+    do { \
+        ctshell_ctx_t *expected_ = (ctx); \
+        __atomic_compare_exchange_n(&g_ctshell_ctx, &expected_, NULL, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE); \
+    } while (0)
+#else
+#define DEFAULT_CTX_LOAD()     (g_ctshell_ctx)
+#define DEFAULT_CTX_STORE(ctx) (g_ctshell_ctx = (ctx))
+#define DEFAULT_CTX_CLEAR(ctx) do { if (g_ctshell_ctx == (ctx)) g_ctshell_ctx = NULL; } while (0)
+#endif
+
+/*
+ * Key decoder: one dense [state][byte] table generated at compile time.
+ * Each cell packs the next state (low nibble) and the emitted event (high nibble).
+ */
+#define DFA_CELL(next, evt) ((uint8_t) (((evt) << 4) | (next)))
+#define DFA_NEXT(cell)      ((cell) & 0x0F)
+#define DFA_EVT(cell)       ((ctshell_key_event_t) ((cell) >> 4))
+
+#define DFA_ROOT_CELL(b) ( \
+    ((b) == CTSHELL_KEY_ENTER || (b) == CTSHELL_KEY_LF) ? DFA_CELL(CTSHELL_DFA_ROOT, CTSHELL_EVT_ENTER) : \
+    ((b) == CTSHELL_KEY_BACKSPACE || (b) == CTSHELL_KEY_BACKSPACE2) ? DFA_CELL(CTSHELL_DFA_ROOT, CTSHELL_EVT_BACKSPACE) : \
+    ((b) == CTSHELL_KEY_TAB) ? DFA_CELL(CTSHELL_DFA_ROOT, CTSHELL_EVT_TAB) : \
+    ((b) == CTSHELL_KEY_CTRL_C) ? DFA_CELL(CTSHELL_DFA_ROOT, CTSHELL_EVT_CTRL_C) : \
+    ((b) == CTSHELL_KEY_ESC) ? DFA_CELL(CTSHELL_DFA_ESC, CTSHELL_EVT_NONE) : \
+    ((b) >= 0x20 && (b) <= 0x7E) ? DFA_CELL(CTSHELL_DFA_ROOT, CTSHELL_EVT_NORMAL_CHAR) : \
+    DFA_CELL(CTSHELL_DFA_ROOT, CTSHELL_EVT_NONE))
+
+/* final byte of a CSI/SS3 sequence, parameters ignored */
+#define DFA_FINAL_CELL(b) ( \
+    ((b) == 'A') ? DFA_CELL(CTSHELL_DFA_ROOT, CTSHELL_EVT_UP) : \
+    ((b) == 'B') ? DFA_CELL(CTSHELL_DFA_ROOT, CTSHELL_EVT_DOWN) : \
+    ((b) == 'C') ? DFA_CELL(CTSHELL_DFA_ROOT, CTSHELL_EVT_RIGHT) : \
+    ((b) == 'D') ? DFA_CELL(CTSHELL_DFA_ROOT, CTSHELL_EVT_LEFT) : \
+    ((b) == 'H') ? DFA_CELL(CTSHELL_DFA_ROOT, CTSHELL_EVT_HOME) : \
+    ((b) == 'F') ? DFA_CELL(CTSHELL_DFA_ROOT, CTSHELL_EVT_END) : \
+    DFA_CELL(CTSHELL_DFA_ROOT, CTSHELL_EVT_NONE))
+
+#define DFA_IS_PARAM(b) ((b) >= 0x20 && (b) <= 0x3F)
+#define DFA_IS_FINAL(b) ((b) >= 0x40 && (b) <= 0x7E)
+
+/* an unexpected byte aborts the sequence and is decoded as if in ROOT */
+#define DFA_ESC_CELL(b) ( \
+    ((b) == '[') ? DFA_CELL(CTSHELL_DFA_CSI, CTSHELL_EVT_NONE) : \
+    ((b) == 'O') ? DFA_CELL(CTSHELL_DFA_SS3, CTSHELL_EVT_NONE) : \
+    DFA_ROOT_CELL(b))
+
+#define DFA_CSI_CELL(b) ( \
+    ((b) == '1' || (b) == '7') ? DFA_CELL(CTSHELL_DFA_CSI_HOME, CTSHELL_EVT_NONE) : \
+    ((b) == '3') ? DFA_CELL(CTSHELL_DFA_CSI_DEL, CTSHELL_EVT_NONE) : \
+    ((b) == '4' || (b) == '8') ? DFA_CELL(CTSHELL_DFA_CSI_END, CTSHELL_EVT_NONE) : \
+    DFA_CSI_PARAM_CELL(b))
+
+#define DFA_CSI_PARAM_CELL(b) ( \
+    DFA_IS_PARAM(b) ? DFA_CELL(CTSHELL_DFA_CSI_PARAM, CTSHELL_EVT_NONE) : \
+    DFA_IS_FINAL(b) ? DFA_FINAL_CELL(b) : \
+    DFA_ROOT_CELL(b))
+
+#define DFA_CSI_TILDE_CELL(b, evt) ( \
+    ((b) == '~') ? DFA_CELL(CTSHELL_DFA_ROOT, evt) : DFA_CSI_PARAM_CELL(b))
+
+#define DFA_CSI_HOME_CELL(b) DFA_CSI_TILDE_CELL(b, CTSHELL_EVT_HOME)
+#define DFA_CSI_DEL_CELL(b)  DFA_CSI_TILDE_CELL(b, CTSHELL_EVT_DELETE)
+#define DFA_CSI_END_CELL(b)  DFA_CSI_TILDE_CELL(b, CTSHELL_EVT_END)
+
+#define DFA_SS3_CELL(b) (DFA_IS_FINAL(b) ? DFA_FINAL_CELL(b) : DFA_ROOT_CELL(b))
+
+#define DFA_ROW4(cell, b)  cell(b), cell((b) + 1), cell((b) + 2), cell((b) + 3)
+#define DFA_ROW16(cell, b) DFA_ROW4(cell, b), DFA_ROW4(cell, (b) + 4), DFA_ROW4(cell, (b) + 8), DFA_ROW4(cell, (b) + 12)
+#define DFA_ROW64(cell, b) DFA_ROW16(cell, b), DFA_ROW16(cell, (b) + 16), DFA_ROW16(cell, (b) + 32), DFA_ROW16(cell, (b) + 48)
+#define DFA_ROW(cell)      {DFA_ROW64(cell, 0), DFA_ROW64(cell, 64), DFA_ROW64(cell, 128), DFA_ROW64(cell, 192)}
+
+static const uint8_t dfa_table[CTSHELL_DFA_STATE_COUNT][256] = {
+        [CTSHELL_DFA_ROOT]      = DFA_ROW(DFA_ROOT_CELL),
+        [CTSHELL_DFA_ESC]       = DFA_ROW(DFA_ESC_CELL),
+        [CTSHELL_DFA_CSI]       = DFA_ROW(DFA_CSI_CELL),
+        [CTSHELL_DFA_CSI_HOME]  = DFA_ROW(DFA_CSI_HOME_CELL),
+        [CTSHELL_DFA_CSI_DEL]   = DFA_ROW(DFA_CSI_DEL_CELL),
+        [CTSHELL_DFA_CSI_END]   = DFA_ROW(DFA_CSI_END_CELL),
+        [CTSHELL_DFA_CSI_PARAM] = DFA_ROW(DFA_CSI_PARAM_CELL),
+        [CTSHELL_DFA_SS3]       = DFA_ROW(DFA_SS3_CELL),
 };
 
-#define DFA_TABLE_SIZE (sizeof(dfa_table) / sizeof(ctshell_dfa_trans_t))
+static void ctshell_tx_drain(ctshell_ctx_t *ctx) {
+    if (ctx->tx_len > 0) {
+        ctx->io.write(ctx->tx_buf, ctx->tx_len, ctx->priv);
+        ctx->tx_len = 0;
+    }
+}
+
+/* buffered output to the port, below redirection, pipes and framing */
+static void ctshell_tx_write(ctshell_ctx_t *ctx, const char *str, int len) {
+    if (!ctx->io.write) return;
+    while (len > 0) {
+        if (ctx->tx_len == 0 && len >= CONFIG_CTSHELL_TX_BUF_SIZE) {
+            // nothing to coalesce with, hand large blocks straight to the port
+            uint16_t chunk = len > UINT16_MAX ? UINT16_MAX : (uint16_t) len;
+            ctx->io.write(str, chunk, ctx->priv);
+            str += chunk;
+            len -= chunk;
+            continue;
+        }
+        int room = CONFIG_CTSHELL_TX_BUF_SIZE - ctx->tx_len;
+        int n = len < room ? len : room;
+        memcpy(&ctx->tx_buf[ctx->tx_len], str, n);
+        ctx->tx_len += n;
+        str += n;
+        len -= n;
+        if (ctx->tx_len == CONFIG_CTSHELL_TX_BUF_SIZE) {
+            ctshell_tx_drain(ctx);
+        }
+    }
+}
+
+#ifdef CONFIG_CTSHELL_USE_PIPE
+static void pipe_write(ctshell_ctx_t *ctx, ctshell_pipe_t *p, const char *str, int len);
+static void pipe_flush(ctshell_ctx_t *ctx, ctshell_pipe_t *p);
+#endif
+
+#ifdef CONFIG_CTSHELL_USE_RPC
+#define RPC_OPEN(ctx) ((ctx)->rpc.open)
+static void rpc_out_write(ctshell_ctx_t *ctx, const char *str, int len);
+static void rpc_out_flush(ctshell_ctx_t *ctx);
+#else
+#define RPC_OPEN(ctx) 0
+#endif
+
+void ctshell_flush(ctshell_ctx_t *ctx) {
+#ifdef CONFIG_CTSHELL_USE_PIPE
+    // inside a pipeline the readers catch up first, so output streams through
+    if (ctx && ctx->out_pipe) pipe_flush(ctx, ctx->out_pipe);
+#endif
+#ifdef CONFIG_CTSHELL_USE_RPC
+    if (ctx && RPC_OPEN(ctx)) rpc_out_flush(ctx);
+#endif
+    if (!ctx || !ctx->io.write || ctx->tx_len == 0) return;
+    ctshell_tx_drain(ctx);
+    if (ctx->io.flush) {
+        ctx->io.flush(ctx->priv);
+    }
+}
+
+#ifdef CONFIG_CTSHELL_USE_FS
+#define OUT_REDIRECTED(ctx) ((ctx)->out_file != NULL)
+
+static void sink_drain(ctshell_ctx_t *ctx, ctshell_file_sink_t *s, const char *buf, int len) {
+    if (s->failed || len == 0) return;
+    if (ctx->fs_drv->write(s->fd, buf, (uint32_t) len) != len) s->failed = 1;
+}
+
+static void sink_write(ctshell_ctx_t *ctx, ctshell_file_sink_t *s, const char *str, int len) {
+    while (len > 0) {
+        if (s->len == 0 && len >= CONFIG_CTSHELL_FS_BLOCK_SIZE) {
+            // whole blocks skip the copy
+            int n = len - len % CONFIG_CTSHELL_FS_BLOCK_SIZE;
+            sink_drain(ctx, s, str, n);
+            str += n;
+            len -= n;
+            continue;
+        }
+        int room = CONFIG_CTSHELL_FS_BLOCK_SIZE - s->len;
+        int n = len < room ? len : room;
+        memcpy(&s->buf[s->len], str, n);
+        s->len += n;
+        str += n;
+        len -= n;
+        if (s->len == CONFIG_CTSHELL_FS_BLOCK_SIZE) {
+            sink_drain(ctx, s, s->buf, s->len);
+            s->len = 0;
+        }
+    }
+}
+
+/* writes the last partial block and gives the output back to the console */
+static void redirect_close(ctshell_ctx_t *ctx) {
+    ctshell_file_sink_t *s = &ctx->sink;
+    if (!s->open) return;
+    ctx->out_file = NULL;
+    s->open = 0;
+    sink_drain(ctx, s, s->buf, s->len);
+    ctx->fs_drv->close(s->fd);
+    if (s->failed) ctshell_ctx_printf(ctx, "write error, output truncated\r\n");
+}
+#else
+#define OUT_REDIRECTED(ctx) 0
+#endif
 
 static void ctshell_write(ctshell_ctx_t *ctx, const char *str, int len) {
-    if (ctx && ctx->io.write && str && len > 0) {
-        ctx->io.write(str, (uint16_t) len, ctx->priv);
+    if (!ctx || !ctx->io.write || !str || len <= 0) return;
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+    if (ctx->hide_line) {
+        ctx->hide_line = 0;
+        ctx->line_hidden = 1;
+        ctshell_write(ctx, "\r\033[K", 4);
+    }
+    if (ctx->line_hidden) ctx->hidden_eol = str[len - 1] == '\n';
+#endif
+#ifdef CONFIG_CTSHELL_USE_STATS
+    ctx->out_bytes += len;
+#endif
+#ifdef CONFIG_CTSHELL_USE_PIPE
+    if (ctx->out_pipe) {
+        pipe_write(ctx, ctx->out_pipe, str, len);
+        return;
+    }
+#endif
+#ifdef CONFIG_CTSHELL_USE_FS
+    if (ctx->out_file) {
+        sink_write(ctx, ctx->out_file, str, len);
+        return;
+    }
+#endif
+#ifdef CONFIG_CTSHELL_USE_RPC
+    if (RPC_OPEN(ctx)) {
+        rpc_out_write(ctx, str, len);
+        return;
     }
+#endif
+    ctx->tx_eol = str[len - 1] == '\n';
+    ctshell_tx_write(ctx, str, len);
 }
 
 static void ctshell_puts(ctshell_ctx_t *ctx, const char *str) {
     if (str) ctshell_write(ctx, str, strlen(str));
 }
 
+#define FMT_LEFT  (1 << 0)
+#define FMT_ZERO  (1 << 1)
+#define FMT_PLUS  (1 << 2)
+#define FMT_SPACE (1 << 3)
+#define FMT_ALT   (1 << 4)
+#define FMT_UPPER (1 << 5)
+
+// "00" "01" ... "99", two decimal digits per lookup
+static const char fmt_dec_pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+static const char fmt_hex_digits[2][16] = {
+        {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'},
+        {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'},
+};
+static const char fmt_spaces[] = "                ";
+static const char fmt_zeros[] = "0000000000000000";
+
+static void fmt_pad(ctshell_ctx_t *ctx, const char *fill, int n) {
+    while (n > 0) {
+        int chunk = n < 16 ? n : 16;
+        ctshell_write(ctx, fill, chunk);
+        n -= chunk;
+    }
+}
+
+/* writes digits backwards ending at `end`, returns the first digit */
+static char *fmt_utoa(char *end, unsigned long long v, int base, int upper) {
+    char *p = end;
+    if (base == 10) {
+        while (v > UINT32_MAX) {
+            unsigned long long q = v / 100;
+            p -= 2;
+            memcpy(p, &fmt_dec_pairs[(v - q * 100) * 2], 2);
+            v = q;
+        }
+        uint32_t v32 = (uint32_t) v;
+        while (v32 >= 100) {
+            uint32_t q = v32 / 100;
+            p -= 2;
+            memcpy(p, &fmt_dec_pairs[(v32 - q * 100) * 2], 2);
+            v32 = q;
+        }
+        if (v32 >= 10) {
+            p -= 2;
+            memcpy(p, &fmt_dec_pairs[v32 * 2], 2);
+        } else {
+            *--p = (char) ('0' + v32);
+        }
+    } else {
+        const char *digits = fmt_hex_digits[upper ? 1 : 0];
+        int shift = (base == 16) ? 4 : 3;
+        unsigned mask = (unsigned) base - 1;
+        do {
+            *--p = digits[v & mask];
+            v >>= shift;
+        } while (v);
+    }
+    return p;
+}
+
+/* emits `[prefix][zeros]body` padded to `width` */
+static void fmt_emit(ctshell_ctx_t *ctx, const char *prefix, int prefix_len, int zeros,
+                     const char *body, int body_len, int width, int flags) {
+    int total = prefix_len + zeros + body_len;
+    int pad = width > total ? width - total : 0;
+
+    if (!(flags & FMT_LEFT)) fmt_pad(ctx, fmt_spaces, pad);
+    ctshell_write(ctx, prefix, prefix_len);
+    fmt_pad(ctx, fmt_zeros, zeros);
+    ctshell_write(ctx, body, body_len);
+    if (flags & FMT_LEFT) fmt_pad(ctx, fmt_spaces, pad);
+}
+
+static void fmt_integer(ctshell_ctx_t *ctx, unsigned long long v, int negative, int base,
+                        int flags, int width, int prec) {
+    char buf[24];
+    char *end = buf + sizeof(buf);
+    char *digits = end;
+    char prefix[3];
+    int prefix_len = 0;
+
+    if (!(prec == 0 && v == 0)) {
+        digits = fmt_utoa(end, v, base, flags & FMT_UPPER);
+    }
+    int n = (int) (end - digits);
+
+    if (negative) {
+        prefix[prefix_len++] = '-';
+    } else if (flags & FMT_PLUS) {
+        prefix[prefix_len++] = '+';
+    } else if (flags & FMT_SPACE) {
+        prefix[prefix_len++] = ' ';
+    }
+    if ((flags & FMT_ALT) && v != 0) {
+        if (base == 16) {
+            prefix[prefix_len++] = '0';
+            prefix[prefix_len++] = (flags & FMT_UPPER) ? 'X' : 'x';
+        } else if (base == 8 && prec <= n) {
+            prec = n + 1;
+        }
+    }
+
+    int zeros = prec > n ? prec - n : 0;
+    if (prec < 0 && (flags & FMT_ZERO) && !(flags & FMT_LEFT)) {
+        int total = prefix_len + n;
+        zeros = width > total ? width - total : 0;
+    }
+    fmt_emit(ctx, prefix, prefix_len, zeros, digits, n, width, flags);
+}
+
+#ifdef CONFIG_CTSHELL_USE_DOUBLE
+static void fmt_double(ctshell_ctx_t *ctx, double v, int flags, int width, int prec) {
+    char buf[48];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+    char prefix[1];
+    int prefix_len = 0;
+
+    if (prec < 0) prec = 6;
+    if (prec > 17) prec = 17;
+
+    if (v < 0 || (v == 0 && 1 / v < 0)) {
+        prefix[prefix_len++] = '-';
+        v = -v;
+    } else if (flags & FMT_PLUS) {
+        prefix[prefix_len++] = '+';
+    } else if (flags & FMT_SPACE) {
+        prefix[prefix_len++] = ' ';
+    }
+
+    if (v != v || v - v != 0) {
+        const char *s = (v != v) ? ((flags & FMT_UPPER) ? "NAN" : "nan")
+                                 : ((flags & FMT_UPPER) ? "INF" : "inf");
+        fmt_emit(ctx, prefix, prefix_len, 0, s, 3, width, flags & ~FMT_ZERO);
+        return;
+    }
+
+    double scale = 1;
+    for (int i = 0; i < prec; i++) scale *= 10;
+    v += 0.5 / scale;
+
+    if (v >= 1e18) {
+        // keep 18 significant digits, the rest is below double resolution anyway
+        int exp10 = 0;
+        while (v >= 1e18) {
+            v /= 10;
+            exp10++;
+        }
+        p = fmt_utoa(end, (unsigned long long) v, 10, 0);
+        int n = (int) (end - p);
+        int pad = width - prefix_len - n - exp10 - (prec > 0 ? prec + 1 : 0);
+        if (!(flags & FMT_LEFT)) fmt_pad(ctx, fmt_spaces, pad);
+        ctshell_write(ctx, prefix, prefix_len);
+        ctshell_write(ctx, p, n);
+        fmt_pad(ctx, fmt_zeros, exp10);
+        if (prec > 0) {
+            ctshell_write(ctx, ".", 1);
+            fmt_pad(ctx, fmt_zeros, prec);
+        }
+        if (flags & FMT_LEFT) fmt_pad(ctx, fmt_spaces, pad);
+        return;
+    }
+
+    unsigned long long ipart = (unsigned long long) v;
+    if (prec > 0) {
+        unsigned long long fpart = (unsigned long long) ((v - (double) ipart) * scale);
+        char *f = fmt_utoa(end, fpart, 10, 0);
+        while (end - f < prec) *--f = '0';
+        *--f = '.';
+        p = f;
+    } else if (flags & FMT_ALT) {
+        *--p = '.';
+    }
+    p = fmt_utoa(p, ipart, 10, 0);
+
+    int n = (int) (end - p);
+    int zeros = 0;
+    if ((flags & FMT_ZERO) && !(flags & FMT_LEFT)) {
+        int total = prefix_len + n;
+        zeros = width > total ? width - total : 0;
+    }
+    fmt_emit(ctx, prefix, prefix_len, zeros, p, n, width, flags);
+}
+#endif
+
+static void ctshell_vprintf(ctshell_ctx_t *ctx, const char *fmt, va_list args) {
+    va_list ap;
+    va_copy(ap, args);
+
+    while (*fmt) {
+        const char *run = fmt;
+        while (*fmt && *fmt != '%') fmt++;
+        ctshell_write(ctx, run, (int) (fmt - run));
+        if (*fmt == '\0') break;
+        const char *spec = fmt++;
+
+        int flags = 0;
+        for (;; fmt++) {
+            if (*fmt == '-') flags |= FMT_LEFT;
+            else if (*fmt == '0') flags |= FMT_ZERO;
+            else if (*fmt == '+') flags |= FMT_PLUS;
+            else if (*fmt == ' ') flags |= FMT_SPACE;
+            else if (*fmt == '#') flags |= FMT_ALT;
+            else break;
+        }
+
+        int width = 0;
+        if (*fmt == '*') {
+            width = va_arg(ap, int);
+            if (width < 0) {
+                flags |= FMT_LEFT;
+                width = -width;
+            }
+            fmt++;
+        } else {
+            while (*fmt >= '0' && *fmt <= '9') width = width * 10 + (*fmt++ - '0');
+        }
+
+        int prec = -1;
+        if (*fmt == '.') {
+            fmt++;
+            prec = 0;
+            if (*fmt == '*') {
+                prec = va_arg(ap, int);
+                if (prec < 0) prec = -1;
+                fmt++;
+            } else {
+                while (*fmt >= '0' && *fmt <= '9') prec = prec * 10 + (*fmt++ - '0');
+            }
+        }
+
+        // 0: int, 1: long, 2: long long, 3: size_t, 4: short, 5: char
+        int length = 0;
+        if (*fmt == 'l') {
+            length = 1;
+            if (*++fmt == 'l') {
+                length = 2;
+                fmt++;
+            }
+        } else if (*fmt == 'h') {
+            length = 4;
+            if (*++fmt == 'h') {
+                length = 5;
+                fmt++;
+            }
+        } else if (*fmt == 'z' || *fmt == 't') {
+            length = 3;
+            fmt++;
+        } else if (*fmt == 'j') {
+            length = 2;
+            fmt++;
+        }
+
+        char conv = *fmt;
+        if (conv == '\0') break;
+        fmt++;
+
+        switch (conv) {
+            case 'd':
+            case 'i': {
+                long long v;
+                if (length == 2) v = va_arg(ap, long long);
+                else if (length == 1) v = va_arg(ap, long);
+                else if (length == 3) v = (long long) va_arg(ap, ptrdiff_t);
+                else v = va_arg(ap, int);
+                // short and char arguments arrive promoted to int
+                if (length == 4) v = (short) v;
+                else if (length == 5) v = (signed char) v;
+                unsigned long long u = v < 0 ? 0ULL - (unsigned long long) v : (unsigned long long) v;
+                fmt_integer(ctx, u, v < 0, 10, flags, width, prec);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o': {
+                unsigned long long v;
+                if (length == 2) v = va_arg(ap, unsigned long long);
+                else if (length == 1) v = va_arg(ap, unsigned long);
+                else if (length == 3) v = va_arg(ap, size_t);
+                else v = va_arg(ap, unsigned int);
+                if (length == 4) v = (unsigned short) v;
+                else if (length == 5) v = (unsigned char) v;
+                int base = (conv == 'u') ? 10 : (conv == 'o') ? 8 : 16;
+                if (conv == 'X') flags |= FMT_UPPER;
+                fmt_integer(ctx, v, 0, base, flags & ~(FMT_PLUS | FMT_SPACE), width, prec);
+                break;
+            }
+            case 'p': {
+                uintptr_t v = (uintptr_t) va_arg(ap, void *);
+                fmt_integer(ctx, v, 0, 16, (flags & FMT_LEFT) | FMT_ALT, width, prec);
+                break;
+            }
+            case 'c': {
+                char c = (char) va_arg(ap, int);
+                fmt_emit(ctx, NULL, 0, 0, &c, 1, width, flags);
+                break;
+            }
+            case 's': {
+                const char *str = va_arg(ap, const char *);
+                if (!str) str = "(null)";
+                int n = 0;
+                while (str[n] && (prec < 0 || n < prec)) n++;
+                fmt_emit(ctx, NULL, 0, 0, str, n, width, flags);
+                break;
+            }
+#ifdef CONFIG_CTSHELL_USE_DOUBLE
+            case 'F':
+                flags |= FMT_UPPER;
+                /* fall through */
+            case 'f':
+                fmt_double(ctx, va_arg(ap, double), flags, width, prec);
+                break;
+#endif
+            case '%':
+                ctshell_write(ctx, "%", 1);
+                break;
+            default:
+                // unsupported conversion, print it verbatim
+                ctshell_write(ctx, spec, (int) (fmt - spec));
+                break;
+        }
+    }
+    va_end(ap);
+}
+
+ctshell_ctx_t *ctshell_current_ctx(void) {
+    return g_ctshell_cur ? g_ctshell_cur : DEFAULT_CTX_LOAD();
+}
+
+void ctshell_ctx_printf(ctshell_ctx_t *ctx, const char *fmt, ...) {
+    if (!ctx || !ctx->io.write || !fmt) return;
+
+    va_list args;
+    va_start(args, fmt);
+    ctshell_vprintf(ctx, fmt, args);
+    va_end(args);
+}
+
 void ctshell_printf(const char *fmt, ...) {
-    if (!g_ctshell_ctx || !g_ctshell_ctx->io.write) return;
+    ctshell_ctx_t *ctx = ctshell_current_ctx();
+    if (!ctx || !ctx->io.write || !fmt) return;
 
-    char buf[128];
     va_list args;
     va_start(args, fmt);
-    int len = vsnprintf(buf, sizeof(buf), fmt, args);
+    ctshell_vprintf(ctx, fmt, args);
     va_end(args);
+}
+
+#define LINE_END (CONFIG_CTSHELL_LINE_BUF_SIZE - 1)
+
+/* physical offset of the text after the cursor */
+static inline int line_tail(const ctshell_ctx_t *ctx) {
+    return LINE_END - (ctx->line_len - ctx->cur_pos);
+}
+
+/* move the gap (and the logical cursor) to `pos`, O(distance) */
+static void line_gap_move(ctshell_ctx_t *ctx, int pos) {
+    int gap = LINE_END - ctx->line_len;
+    if (pos < ctx->cur_pos) {
+        memmove(&ctx->line_buf[pos + gap], &ctx->line_buf[pos], ctx->cur_pos - pos);
+    } else if (pos > ctx->cur_pos) {
+        memmove(&ctx->line_buf[ctx->cur_pos], &ctx->line_buf[ctx->cur_pos + gap], pos - ctx->cur_pos);
+    }
+    ctx->cur_pos = pos;
+}
+
+/* close the gap so line_buf holds the line as a C string */
+static void line_flatten(ctshell_ctx_t *ctx) {
+    line_gap_move(ctx, ctx->line_len);
+    ctx->line_buf[ctx->line_len] = '\0';
+}
+
+static void line_reset(ctshell_ctx_t *ctx) {
+    ctx->line_len = 0;
+    ctx->cur_pos = 0;
+    ctx->line_buf[0] = '\0';
+    ctx->line_buf[LINE_END] = '\0';
+}
+
+/* echo of the edit line, suppressed when the terminal echoes locally */
+static void view_write(ctshell_ctx_t *ctx, const char *str, int len) {
+    if (!ctx->no_echo) ctshell_write(ctx, str, len);
+}
+
+static void view_pad(ctshell_ctx_t *ctx, const char *fill, int n) {
+    if (!ctx->no_echo) fmt_pad(ctx, fill, n);
+}
+
+/* write the logical range [from, to) of the line */
+static void line_write(ctshell_ctx_t *ctx, int from, int to) {
+    if (from < ctx->cur_pos) {
+        int end = to < ctx->cur_pos ? to : ctx->cur_pos;
+        view_write(ctx, &ctx->line_buf[from], end - from);
+        from = end;
+    }
+    if (to > from) {
+        int gap = LINE_END - ctx->line_len;
+        view_write(ctx, &ctx->line_buf[from + gap], to - from);
+    }
+}
+
+/*
+ * Line view updates. Every edit picks the cheapest of the equivalent byte
+ * sequences, e.g. "\b\b" vs "ESC[12D", rewriting the tail vs "ESC[@"/"ESC[P".
+ * Costs are exact byte counts; the terminal cursor is assumed to sit at
+ * `from` on entry of each helper.
+ */
+static const char view_bs[] = "\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b";
+
+static int view_csi_len(int n) {
+    if (n == 1) return 3;
+    return n < 10 ? 4 : n < 100 ? 5 : n < 1000 ? 6 : 7;
+}
+
+static void view_csi(ctshell_ctx_t *ctx, int n, char final) {
+    char buf[8];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+    *--p = final;
+    if (n != 1) p = fmt_utoa(p, (unsigned) n, 10, 0);
+    *--p = '[';
+    *--p = '\033';
+    view_write(ctx, p, (int) (end - p));
+}
 
-    if (len > 0) {
-        g_ctshell_ctx->io.write(buf, (uint16_t) len, g_ctshell_ctx->priv);
+static int view_left_cost(int n) {
+    if (n <= 0) return 0;
+    int csi = view_csi_len(n);
+    return n < csi ? n : csi;
+}
+
+static void view_left(ctshell_ctx_t *ctx, int n) {
+    if (n <= 0) return;
+    if (n <= view_csi_len(n)) {
+        view_pad(ctx, view_bs, n);
+    } else {
+        view_csi(ctx, n, 'D');
+    }
+}
+
+static void view_move(ctshell_ctx_t *ctx, int from, int to) {
+    if (to < from) {
+        view_left(ctx, from - to);
+    } else if (to > from) {
+        int n = to - from;
+        // retyping the characters already on screen is often shorter than ESC[nC
+        if (n <= view_csi_len(n)) {
+            line_write(ctx, from, to);
+        } else {
+            view_csi(ctx, n, 'C');
+        }
     }
 }
 
-static void ctshell_cursor_left(ctshell_ctx_t *ctx) { ctshell_puts(ctx, "\033[D"); }
-static void ctshell_cursor_right(ctshell_ctx_t *ctx) { ctshell_puts(ctx, "\033[C"); }
+/* `n` chars were inserted into the line at `from`, cursor ends after them */
+static void view_insert(ctshell_ctx_t *ctx, int from, int n) {
+    int tail = ctx->line_len - from - n;
+    int retype = n + tail + view_left_cost(tail);
+    int ich = view_csi_len(n) + n;
 
-static void ctshell_redraw_tail(ctshell_ctx_t *ctx) {
-    ctshell_puts(ctx, ctx->line_buf + ctx->cur_pos);
-    ctshell_puts(ctx, " ");
+    if (tail > 0 && ich < retype) {
+        view_csi(ctx, n, '@');
+        line_write(ctx, from, from + n);
+    } else {
+        line_write(ctx, from, ctx->line_len);
+        view_left(ctx, tail);
+    }
+}
+
+/* `n` chars were removed from the line at `from`, cursor stays at `from` */
+static void view_delete(ctshell_ctx_t *ctx, int from, int n) {
+    int tail = ctx->line_len - from;
+    int blank = tail + n + view_left_cost(tail + n);
+    int erase = tail + 3 + view_left_cost(tail);
+    int dch = view_csi_len(n);
+
+    if (tail > 0 && dch <= blank && dch <= erase) {
+        view_csi(ctx, n, 'P');
+        return;
+    }
+    line_write(ctx, from, ctx->line_len);
+    if (blank <= erase) {
+        view_pad(ctx, fmt_spaces, n);
+        view_left(ctx, tail + n);
+    } else {
+        view_write(ctx, "\033[K", 3);
+        view_left(ctx, tail);
+    }
+}
 
-    int tail_len = ctx->line_len - ctx->cur_pos + 1;
-    while (tail_len--) {
-        ctshell_cursor_left(ctx);
+/* replace the whole line, keeping whatever prefix is already on screen */
+static void view_replace(ctshell_ctx_t *ctx, const char *line) {
+    int shown = ctx->cur_pos;
+    line_flatten(ctx);
+
+    int keep = 0;
+    while (keep < ctx->line_len && line[keep] && line[keep] == ctx->line_buf[keep]) {
+        keep++;
+    }
+    int len = keep + (int) strlen(line + keep);
+    if (len > CONFIG_CTSHELL_LINE_BUF_SIZE - 1) len = CONFIG_CTSHELL_LINE_BUF_SIZE - 1;
+
+    view_move(ctx, shown, keep);
+    int old_len = ctx->line_len;
+    memcpy(&ctx->line_buf[keep], line + keep, len - keep);
+    ctx->line_len = len;
+    ctx->cur_pos = len;
+
+    view_write(ctx, &ctx->line_buf[keep], len - keep);
+    if (old_len > len) {
+        int n = old_len - len;
+        // n spaces plus n cursor moves back, or a single erase-to-end
+        if (n + view_left_cost(n) < 3) {
+            view_pad(ctx, fmt_spaces, n);
+            view_left(ctx, n);
+        } else {
+            view_write(ctx, "\033[K", 3);
+        }
     }
 }
 
 static void ctshell_clear_line_view(ctshell_ctx_t *ctx) {
-    while (ctx->cur_pos < ctx->line_len) {
-        ctshell_puts(ctx, "\033[C");
-        ctx->cur_pos++;
+    view_replace(ctx, "");
+}
+
+/*
+ * Variables are packed back to back in var_arena, each as
+ *   [name length][value length] name '\0' value '\0'
+ * and found through var_index, an open-addressing table with linear probing.
+ * unset closes the gap it leaves, so the free space is always at the end.
+ */
+#define VAR_HDR 2
+
+static inline int var_size(const char *v) {
+    return VAR_HDR + (uint8_t) v[0] + (uint8_t) v[1] + 2;
+}
+
+static inline const char *var_name(const char *v) {
+    return v + VAR_HDR;
+}
+
+static inline char *var_value(char *v) {
+    return v + VAR_HDR + (uint8_t) v[0] + 1;
+}
+
+static inline char *var_at(ctshell_ctx_t *ctx, int slot) {
+    return &ctx->var_arena[ctx->var_index[slot] - 1];
+}
+
+static int var_len(const char *s, int max) {
+    int n = 0;
+    while (n < max && s[n]) n++;
+    return n;
+}
+
+static uint32_t var_hash(const char *name, int len) {
+    uint32_t h = 2166136261u;
+    while (len-- > 0) {
+        h ^= (uint8_t) *name++;
+        h *= 16777619u;
     }
-    while (ctx->line_len > 0) {
-        ctshell_puts(ctx, "\b \b");
-        ctx->line_len--;
+    return h;
+}
+
+/* the slot holding `name`, or the empty slot that ends its probe sequence */
+static int var_slot(ctshell_ctx_t *ctx, const char *name, int len) {
+    int i = var_hash(name, len) & VAR_INDEX_MASK;
+    while (ctx->var_index[i]) {
+        const char *v = var_at(ctx, i);
+        if ((uint8_t) v[0] == len && memcmp(var_name(v), name, len) == 0) break;
+        i = (i + 1) & VAR_INDEX_MASK;
     }
-    ctx->cur_pos = 0;
-    ctx->line_buf[0] = '\0';
+    return i;
+}
+
+static const char *find_var(ctshell_ctx_t *ctx, const char *name, int len) {
+    int i = var_slot(ctx, name, len);
+    return ctx->var_index[i] ? var_value(var_at(ctx, i)) : NULL;
 }
 
-static ctshell_var_t *find_var(ctshell_ctx_t *ctx, const char *name) {
-    for (int i = 0; i < CONFIG_CTSHELL_VAR_MAX_COUNT; i++) {
-        if (ctx->vars[i].used && strcmp(ctx->vars[i].name, name) == 0) {
-            return &ctx->vars[i];
+static void var_remove(ctshell_ctx_t *ctx, int slot) {
+    int off = ctx->var_index[slot] - 1;
+    int size = var_size(&ctx->var_arena[off]);
+
+    // backward shift: later members of the probe sequence move up into the hole
+    int hole = slot;
+    for (int i = (slot + 1) & VAR_INDEX_MASK; ctx->var_index[i]; i = (i + 1) & VAR_INDEX_MASK) {
+        const char *v = var_at(ctx, i);
+        int home = var_hash(var_name(v), (uint8_t) v[0]) & VAR_INDEX_MASK;
+        if (((i - home) & VAR_INDEX_MASK) >= ((i - hole) & VAR_INDEX_MASK)) {
+            ctx->var_index[hole] = ctx->var_index[i];
+            hole = i;
         }
     }
-    return NULL;
+    ctx->var_index[hole] = 0;
+
+    memmove(&ctx->var_arena[off], &ctx->var_arena[off + size], ctx->var_used - off - size);
+    ctx->var_used -= size;
+    ctx->var_count--;
+    for (int i = 0; i < CTSHELL_VAR_INDEX_SIZE; i++) {
+        if (ctx->var_index[i] > off + 1) ctx->var_index[i] -= size;
+    }
 }
 
 static int set_var(ctshell_ctx_t *ctx, const char *name, const char *value) {
-    ctshell_var_t *var = find_var(ctx, name);
-    if (var) {
-        strncpy(var->value, value, CONFIG_CTSHELL_VAR_VAL_LEN - 1);
-        var->value[CONFIG_CTSHELL_VAR_VAL_LEN - 1] = '\0';
-        return 0;
-    }
-    for (int i = 0; i < CONFIG_CTSHELL_VAR_MAX_COUNT; i++) {
-        if (!ctx->vars[i].used) {
-            strncpy(ctx->vars[i].name, name, CONFIG_CTSHELL_VAR_NAME_LEN - 1);
-            ctx->vars[i].name[CONFIG_CTSHELL_VAR_NAME_LEN - 1] = '\0';
-            strncpy(ctx->vars[i].value, value, CONFIG_CTSHELL_VAR_VAL_LEN - 1);
-            ctx->vars[i].value[CONFIG_CTSHELL_VAR_VAL_LEN - 1] = '\0';
-            ctx->vars[i].used = 1;
+    int name_len = var_len(name, CONFIG_CTSHELL_VAR_NAME_LEN - 1);
+    int val_len = var_len(value, CONFIG_CTSHELL_VAR_VAL_LEN - 1);
+    int size = VAR_HDR + name_len + val_len + 2;
+    int room = CONFIG_CTSHELL_VAR_ARENA_SIZE - ctx->var_used;
+    int slot = var_slot(ctx, name, name_len);
+
+    if (ctx->var_index[slot]) {
+        char *v = var_at(ctx, slot);
+        if ((uint8_t) v[1] == val_len) {
+            memcpy(var_value(v), value, val_len);
             return 0;
         }
+        if (size > room + var_size(v)) return -1;
+        // a value of another length moves the variable to the end
+        var_remove(ctx, slot);
+        slot = var_slot(ctx, name, name_len);
+    } else if (ctx->var_count == CONFIG_CTSHELL_VAR_MAX_COUNT || size > room) {
+        return -1;
     }
-    return -1;
+
+    char *v = &ctx->var_arena[ctx->var_used];
+    v[0] = (char) name_len;
+    v[1] = (char) val_len;
+    memcpy(v + VAR_HDR, name, name_len);
+    v[VAR_HDR + name_len] = '\0';
+    memcpy(var_value(v), value, val_len);
+    var_value(v)[val_len] = '\0';
+    ctx->var_index[slot] = ctx->var_used + 1;
+    ctx->var_used += size;
+    ctx->var_count++;
+    return 0;
 }
 
 static void unset_var(ctshell_ctx_t *ctx, const char *name) {
-    ctshell_var_t *var = find_var(ctx, name);
-    if (var) var->used = 0;
+    int slot = var_slot(ctx, name, var_len(name, CONFIG_CTSHELL_VAR_NAME_LEN - 1));
+    if (ctx->var_index[slot]) var_remove(ctx, slot);
 }
 
-static int ctshell_expand_vars(ctshell_ctx_t *ctx) {
-    char *p = strchr(ctx->line_buf, '$');
-    if (!p) return 0;
+/*
+ * The command line tokenizer, shared by execution and completion. Arguments
+ * are separated by spaces. A quote at the start of an argument runs to the
+ * matching quote and ends the argument there. A backslash escapes any
+ * character outside quotes and `"`, `\` or `$` inside double quotes;
+ * nothing is escaped inside single quotes.
+ *
+ * Spans index the scanned buffer, which is left alone; only span_arg, when
+ * exec builds argv, writes into it.
+ */
+typedef struct {
+    const char *buf;
+    int pos;
+    int len;
+} ctshell_tok_t;
+
+typedef struct {
+    uint16_t start; // first character after the opening quote, if any
+    uint16_t len;   // raw length, escapes included
+    char quote;     // '"', '\'' or 0
+    uint8_t esc;    // contains escapes
+    uint8_t open;   // runs to the end of the input: no closing quote or space follows
+} ctshell_span_t;
+
+static inline int tok_escapes(char quote, char next) {
+    if (quote == '\'') return 0;
+    return !quote || next == '"' || next == '\\' || next == '$';
+}
 
-    while (p) {
-        char var_name[CONFIG_CTSHELL_VAR_NAME_LEN] = {0};
-        char *end = p + 1;
-        int n_len = 0;
+static void tok_init(ctshell_tok_t *t, const char *buf, int len) {
+    t->buf = buf;
+    t->pos = 0;
+    t->len = len;
+}
 
-        while (*end && (isalnum((int) *end) || *end == '_') && n_len < CONFIG_CTSHELL_VAR_NAME_LEN - 1) {
-            var_name[n_len++] = *end++;
+static int tok_next(ctshell_tok_t *t, ctshell_span_t *sp) {
+    const char *b = t->buf;
+    while (t->pos < t->len && b[t->pos] == ' ') t->pos++;
+    if (t->pos >= t->len) return 0;
+
+    char c = b[t->pos];
+    sp->quote = (c == '"' || c == '\'') ? c : 0;
+    if (sp->quote) t->pos++;
+    sp->start = t->pos;
+    sp->esc = 0;
+    while (t->pos < t->len) {
+        c = b[t->pos];
+        if (sp->quote ? c == sp->quote : c == ' ') break;
+        if (c == '\\' && t->pos + 1 < t->len && tok_escapes(sp->quote, b[t->pos + 1])) {
+            sp->esc = 1;
+            t->pos++;
         }
-        var_name[n_len] = '\0';
+        t->pos++;
+    }
+    sp->len = t->pos - sp->start;
+    // the closing quote or space is consumed, so span_arg may overwrite it
+    sp->open = t->pos == t->len;
+    if (!sp->open) t->pos++;
+    return 1;
+}
 
-        if (n_len == 0) {
-            p = strchr(p + 1, '$');
-            continue;
-        }
+/* copies the argument without its escapes into `out` (which may be the span itself), -1 if it does not fit */
+static int span_unescape(const char *buf, const ctshell_span_t *sp, char *out, int size) {
+    const char *s = &buf[sp->start];
+    int n = 0;
+    for (int i = 0; i < sp->len; i++) {
+        if (s[i] == '\\' && i + 1 < sp->len && tok_escapes(sp->quote, s[i + 1])) i++;
+        if (n == size - 1) return -1;
+        out[n++] = s[i];
+    }
+    out[n] = '\0';
+    return n;
+}
+
+/*
+ * Terminates the argument in place and returns it. Like a quoted one, an
+ * escaped argument is preceded by a non-space byte (its first backslash is
+ * kept there), so `\|` stays an argument and never becomes an operator.
+ */
+static char *span_arg(char *buf, const ctshell_span_t *sp) {
+    char *s = &buf[sp->start];
+    if (!sp->esc) {
+        s[sp->len] = '\0';
+        return s;
+    }
+    int n = span_unescape(buf, sp, s, sp->len + 1);
+    memmove(s + 1, s, n);
+    s[0] = '\\';
+    s[n + 1] = '\0';
+    return s + 1;
+}
 
-        ctshell_var_t *var = find_var(ctx, var_name);
-        const char *val_str = var ? var->value : "";
-        int val_len = strlen(val_str);
-        int diff = val_len - (1 + n_len);
+static inline int is_name_char(char c) {
+    return isalnum((int) c) || c == '_';
+}
 
-        if (strlen(ctx->line_buf) + diff >= CONFIG_CTSHELL_LINE_BUF_SIZE - 1) return 0;
+/*
+ * Copies `line` to `out` in one pass, replacing $name and ${name} with the
+ * value of the variable, or nothing if it is not set. Quotes and escapes
+ * follow the tokenizer, which sees them next: nothing is expanded between
+ * single quotes or after a backslash. Returns the length of the result, or
+ * -1 after reporting a result that does not fit in `size` bytes or a
+ * malformed ${}.
+ */
+static int ctshell_expand_vars(ctshell_ctx_t *ctx, const char *line, char *out, int size) {
+    const char *p = line;
+    char quote = 0;
+    int arg_start = 1; // the tokenizer would start an argument here
+    int n = 0;
 
-        memmove(p + val_len, end, strlen(end) + 1);
-        memcpy(p, val_str, val_len);
-        ctx->line_len += diff;
-        p = strchr(p + val_len, '$');
+    while (*p) {
+        const char *val = p;
+        int len = 1;
+        const char *next = p + 1;
+        int at_start = 0;
+        if (*p == '\\' && p[1] && tok_escapes(quote, p[1])) {
+            // kept for the tokenizer
+            len = 2;
+            next = p + 2;
+        } else if (quote && *p == quote) {
+            quote = 0;
+            at_start = 1;
+        } else if (!quote && arg_start && (*p == '"' || *p == '\'')) {
+            quote = *p;
+        } else if (!quote && *p == ' ') {
+            at_start = 1;
+        } else if (*p == '$' && quote != '\'') {
+            const char *name = p + 1;
+            int name_len = 0;
+            if (*name == '{') {
+                name++;
+                while (is_name_char(name[name_len])) name_len++;
+                if (name_len == 0 || name[name_len] != '}') {
+                    ctshell_printf("\r\nbad substitution");
+                    return -1;
+                }
+                next = name + name_len + 1;
+            } else {
+                while (is_name_char(name[name_len])) name_len++;
+                next = name + name_len;
+            }
+            if (name_len > 0) {
+                val = find_var(ctx, name, name_len);
+                len = val ? (int) strlen(val) : 0;
+            }
+        }
+        if (n + len >= size) {
+            ctshell_printf("\r\nline too long after expansion");
+            return -1;
+        }
+        memcpy(&out[n], val, len);
+        n += len;
+        p = next;
+        arg_start = at_start;
     }
-    return 1;
+    out[n] = '\0';
+    return n;
 }
 
 static void ctshell_save_history(ctshell_ctx_t *ctx) {
@@ -178,16 +1138,167 @@ static void ctshell_save_history(ctshell_ctx_t *ctx) {
 }
 
 static void ctshell_load_history(ctshell_ctx_t *ctx, int index) {
-    ctshell_clear_line_view(ctx);
-    strncpy(ctx->line_buf, ctx->history[index], CONFIG_CTSHELL_LINE_BUF_SIZE - 1);
-    ctx->line_len = strlen(ctx->line_buf);
-    ctx->cur_pos = ctx->line_len;
-    ctshell_puts(ctx, ctx->line_buf);
+    view_replace(ctx, ctx->history[index]);
 }
 
-static const ctshell_cmd_t *find_cmd_in_section(const char *name, const ctshell_cmd_t *parent) {
-    const ctshell_cmd_t *cmd = CMD_START;
-    const ctshell_cmd_t *end = CMD_END;
+#if CONFIG_CTSHELL_CMD_INDEX_SIZE > 0
+#define CMD_INDEX_NONE 0xFFFF
+#define CMD_INDEX_ROOT CONFIG_CTSHELL_CMD_INDEX_SIZE
+
+/*
+ * Built once by ctshell_init over the (read-only) command section:
+ * - bucket/next: hash chains keyed by parent + name
+ * - order: command ids grouped by parent, section order kept within a group
+ * - sorted: same ranges as `order`, but each group sorted by name so that
+ *   prefix matches are contiguous and found by binary search
+ * - child_start/child_count: range of each parent's children in `order`
+ *   and `sorted`, the root level lives at CMD_INDEX_ROOT
+ */
+typedef struct {
+    uint16_t count;
+    uint32_t state;
+    uint16_t bucket[CONFIG_CTSHELL_CMD_INDEX_SIZE];
+    uint16_t next[CONFIG_CTSHELL_CMD_INDEX_SIZE];
+    uint16_t order[CONFIG_CTSHELL_CMD_INDEX_SIZE];
+    uint16_t sorted[CONFIG_CTSHELL_CMD_INDEX_SIZE];
+    uint16_t child_start[CONFIG_CTSHELL_CMD_INDEX_SIZE + 1];
+    uint16_t child_count[CONFIG_CTSHELL_CMD_INDEX_SIZE + 1];
+    uint8_t is_menu[CONFIG_CTSHELL_CMD_INDEX_SIZE];
+} ctshell_cmd_index_t;
+
+static ctshell_cmd_index_t cmd_index;
+
+#define CMD_INDEX_BUILDING 1
+#define CMD_INDEX_BUILT    2
+
+/* lookups fall back to a linear scan until the index is published */
+static inline int cmd_index_ready(void) {
+    return SHARED_LOAD_ACQUIRE(&cmd_index.state) == CMD_INDEX_BUILT;
+}
+
+/* the first shell to get here builds the index, the others never wait */
+static int cmd_index_claim(void) {
+#if defined(__ATOMIC_ACQUIRE)
+    uint32_t idle = 0;
+    return __atomic_compare_exchange_n(&cmd_index.state, &idle, CMD_INDEX_BUILDING, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+#else
+    if (cmd_index.state != 0) return 0;
+    cmd_index.state = CMD_INDEX_BUILDING;
+    return 1;
+#endif
+}
+
+static uint32_t cmd_hash(const char *name, uint16_t parent_id) {
+    uint32_t h = 2166136261u ^ ((uint32_t) parent_id * 0x9E3779B1u);
+    while (*name) {
+        h ^= (uint8_t) *name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint16_t cmd_index_id(const ctshell_cmd_t *parent) {
+    if (!parent) return CMD_INDEX_ROOT;
+    if (parent < CMD_START || parent >= CMD_START + cmd_index.count) return CMD_INDEX_NONE;
+    return (uint16_t) (parent - CMD_START);
+}
+
+static void cmd_sift_down(uint16_t *a, int root, int n) {
+    while (2 * root + 1 < n) {
+        int child = 2 * root + 1;
+        if (child + 1 < n && strcmp(CMD_START[a[child]].name, CMD_START[a[child + 1]].name) < 0) {
+            child++;
+        }
+        if (strcmp(CMD_START[a[root]].name, CMD_START[a[child]].name) >= 0) return;
+        uint16_t t = a[root];
+        a[root] = a[child];
+        a[child] = t;
+        root = child;
+    }
+}
+
+/* in-place heapsort by name, no extra memory and O(n log n) for large groups */
+static void cmd_sort_by_name(uint16_t *a, int n) {
+    for (int i = n / 2 - 1; i >= 0; i--) {
+        cmd_sift_down(a, i, n);
+    }
+    for (int end = n - 1; end > 0; end--) {
+        uint16_t t = a[0];
+        a[0] = a[end];
+        a[end] = t;
+        cmd_sift_down(a, 0, end);
+    }
+}
+
+/* returns -1 when more commands are linked in than the index holds */
+static int ctshell_cmd_index_build(void) {
+    size_t total = (size_t) (CMD_END - CMD_START);
+    if (total > CONFIG_CTSHELL_CMD_INDEX_SIZE) return -1;
+    if (!cmd_index_claim()) return 0;
+
+    uint16_t count = (uint16_t) total;
+    cmd_index.count = count;
+    memset(cmd_index.bucket, 0xFF, sizeof(cmd_index.bucket));
+    memset(cmd_index.child_count, 0, sizeof(cmd_index.child_count));
+
+    for (uint16_t i = 0; i < count; i++) {
+        uint16_t pid = cmd_index_id(CMD_START[i].parent);
+        cmd_index.next[i] = CMD_INDEX_NONE;
+        if (pid == CMD_INDEX_NONE) continue;
+        uint32_t b = cmd_hash(CMD_START[i].name, pid) % CONFIG_CTSHELL_CMD_INDEX_SIZE;
+        cmd_index.next[i] = cmd_index.bucket[b];
+        cmd_index.bucket[b] = i;
+        cmd_index.child_count[pid]++;
+    }
+
+    uint16_t pos = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        cmd_index.child_start[i] = pos;
+        pos += cmd_index.child_count[i];
+    }
+    cmd_index.child_start[CMD_INDEX_ROOT] = pos;
+
+    // second pass places children, reusing child_count as the fill cursor
+    memset(cmd_index.child_count, 0, sizeof(cmd_index.child_count));
+    for (uint16_t i = 0; i < count; i++) {
+        uint16_t pid = cmd_index_id(CMD_START[i].parent);
+        if (pid == CMD_INDEX_NONE) continue;
+        cmd_index.order[cmd_index.child_start[pid] + cmd_index.child_count[pid]++] = i;
+    }
+
+    memcpy(cmd_index.sorted, cmd_index.order, count * sizeof(uint16_t));
+    for (uint16_t i = 0; i < count; i++) {
+        cmd_sort_by_name(&cmd_index.sorted[cmd_index.child_start[i]], cmd_index.child_count[i]);
+    }
+    cmd_sort_by_name(&cmd_index.sorted[cmd_index.child_start[CMD_INDEX_ROOT]],
+                     cmd_index.child_count[CMD_INDEX_ROOT]);
+
+    for (uint16_t i = 0; i < count; i++) {
+        const ctshell_cmd_t *cmd = &CMD_START[i];
+        cmd_index.is_menu[i] = (cmd->attrs & CTSHELL_ATTR_MENU) || cmd->func == NULL || cmd_index.child_count[i] > 0;
+    }
+    SHARED_STORE_RELEASE(&cmd_index.state, CMD_INDEX_BUILT);
+    return 0;
+}
+#endif
+
+static const ctshell_cmd_t *find_cmd_in_section(const char *name, const ctshell_cmd_t *parent) {
+#if CONFIG_CTSHELL_CMD_INDEX_SIZE > 0
+    if (cmd_index_ready()) {
+        uint16_t pid = cmd_index_id(parent);
+        if (pid == CMD_INDEX_NONE) return NULL;
+        uint16_t i = cmd_index.bucket[cmd_hash(name, pid) % CONFIG_CTSHELL_CMD_INDEX_SIZE];
+        for (; i != CMD_INDEX_NONE; i = cmd_index.next[i]) {
+            if (CMD_START[i].parent == parent && strcmp(CMD_START[i].name, name) == 0) {
+                return &CMD_START[i];
+            }
+        }
+        return NULL;
+    }
+#endif
+    const ctshell_cmd_t *cmd = CMD_START;
+    const ctshell_cmd_t *end = CMD_END;
     for (; cmd < end; cmd++) {
         if (cmd->parent == parent && strcmp(cmd->name, name) == 0) {
             return cmd;
@@ -197,6 +1308,12 @@ static const ctshell_cmd_t *find_cmd_in_section(const char *name, const ctshell_
 }
 
 static int ctshell_has_children(const ctshell_cmd_t *parent) {
+#if CONFIG_CTSHELL_CMD_INDEX_SIZE > 0
+    if (cmd_index_ready()) {
+        uint16_t pid = cmd_index_id(parent);
+        return pid != CMD_INDEX_NONE && cmd_index.child_count[pid] > 0;
+    }
+#endif
     const ctshell_cmd_t *cmd = CMD_START;
     const ctshell_cmd_t *end = CMD_END;
     for (; cmd < end; cmd++) {
@@ -209,144 +1326,319 @@ static int ctshell_has_children(const ctshell_cmd_t *parent) {
 
 static int ctshell_is_menu(const ctshell_cmd_t *cmd) {
     if (!cmd) return 0;
+#if CONFIG_CTSHELL_CMD_INDEX_SIZE > 0
+    if (cmd_index_ready()) {
+        uint16_t id = cmd_index_id(cmd);
+        if (id != CMD_INDEX_NONE) return cmd_index.is_menu[id];
+    }
+#endif
     if (cmd->attrs & CTSHELL_ATTR_MENU) return 1;
     if (cmd->func == NULL) return 1;
     return ctshell_has_children(cmd);
 }
 
+/*
+ * Iterates over the direct children of `parent` (NULL for top-level commands).
+ * With a prefix, only children whose name starts with it are returned, in
+ * name order when the index is available.
+ */
+typedef struct {
+    const ctshell_cmd_t *parent;
+    const char *prefix;
+    int prefix_len;
+    const uint16_t *list;
+    uint16_t pos;
+    uint16_t end;
+} ctshell_cmd_iter_t;
+
+static void ctshell_cmd_iter_init(ctshell_cmd_iter_t *it, const ctshell_cmd_t *parent) {
+    it->parent = parent;
+    it->prefix = NULL;
+    it->prefix_len = 0;
+    it->list = NULL;
+    it->pos = 0;
+    it->end = (uint16_t) (CMD_END - CMD_START);
+#if CONFIG_CTSHELL_CMD_INDEX_SIZE > 0
+    if (cmd_index_ready()) {
+        uint16_t pid = cmd_index_id(parent);
+        it->list = cmd_index.order;
+        if (pid == CMD_INDEX_NONE) {
+            it->end = 0;
+            return;
+        }
+        it->pos = cmd_index.child_start[pid];
+        it->end = it->pos + cmd_index.child_count[pid];
+    }
+#endif
+}
+
+static void ctshell_cmd_iter_init_prefix(ctshell_cmd_iter_t *it, const ctshell_cmd_t *parent,
+                                         const char *prefix, int prefix_len) {
+    ctshell_cmd_iter_init(it, parent);
+    it->prefix = prefix;
+    it->prefix_len = prefix_len;
+#if CONFIG_CTSHELL_CMD_INDEX_SIZE > 0
+    if (it->list) {
+        it->list = cmd_index.sorted;
+        uint16_t lo = it->pos, hi = it->end;
+        while (lo < hi) {
+            uint16_t mid = lo + (hi - lo) / 2;
+            if (strncmp(CMD_START[it->list[mid]].name, prefix, prefix_len) < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        it->pos = lo;
+        hi = it->end;
+        while (lo < hi) {
+            uint16_t mid = lo + (hi - lo) / 2;
+            if (strncmp(CMD_START[it->list[mid]].name, prefix, prefix_len) <= 0) lo = mid + 1;
+            else hi = mid;
+        }
+        it->end = lo;
+    }
+#endif
+}
+
+static const ctshell_cmd_t *ctshell_cmd_iter_next(ctshell_cmd_iter_t *it) {
+#if CONFIG_CTSHELL_CMD_INDEX_SIZE > 0
+    if (it->list) {
+        return it->pos < it->end ? &CMD_START[it->list[it->pos++]] : NULL;
+    }
+#endif
+    while (it->pos < it->end) {
+        const ctshell_cmd_t *cmd = &CMD_START[it->pos++];
+        if (cmd->parent != it->parent) continue;
+        if (it->prefix && strncmp(cmd->name, it->prefix, it->prefix_len) != 0) continue;
+        return cmd;
+    }
+    return NULL;
+}
+
 void ctshell_check_abort(ctshell_ctx_t *ctx) {
-    if (ctx && ctx->sigint) {
+    // asynchronous commands are cancelled by ctshell_poll instead
+    if (ctx && ctx->sigint && ctx->is_executing) {
         ctx->sigint = 0;
+#ifdef CONFIG_CTSHELL_USE_FS
+        // the abort is reported on the console, the line that opened the file closes it
+        ctx->out_file = NULL;
+#endif
         longjmp(ctx->jump_env, 1);
     }
 }
 
-static int is_trailing_space(const char *str) {
-    if (!str || *str == '\0') return 0;
-    int len = strlen(str);
-    return str[len - 1] == ' ';
+static void ctshell_complete_insert(ctshell_ctx_t *ctx, const char *str, int len) {
+    int room = CONFIG_CTSHELL_LINE_BUF_SIZE - 1 - ctx->line_len;
+    if (len > room) len = room;
+    if (len <= 0) return;
+    memcpy(&ctx->line_buf[ctx->cur_pos], str, len);
+    ctx->cur_pos += len;
+    ctx->line_len += len;
+    view_insert(ctx, ctx->cur_pos - len, len);
 }
 
-static void ctshell_tab_complete(ctshell_ctx_t *ctx) {
-    if (ctx->line_len == 0) return;
+static const ctshell_arg_spec_t *find_spec(const ctshell_cmd_t *cmd, const char *arg, int verb) {
+    for (int i = 0; i < cmd->nargs; i++) {
+        const ctshell_arg_spec_t *sp = &cmd->args[i];
+        if ((sp->type == CTSHELL_ARG_VERB) == verb && strcmp(sp->flag, arg) == 0) return sp;
+    }
+    return NULL;
+}
 
-    char buf_copy[CONFIG_CTSHELL_LINE_BUF_SIZE];
-    strncpy(buf_copy, ctx->line_buf, sizeof(buf_copy));
-    buf_copy[CONFIG_CTSHELL_LINE_BUF_SIZE - 1] = '\0';
+/* applies what `count` candidates starting with the typed prefix share, returns 1 if they must be listed */
+static int ctshell_complete_apply(ctshell_ctx_t *ctx, const char *first, int match_len, int common_len,
+                                  int count, char open_quote) {
+    if (count == 1) {
+        ctshell_complete_insert(ctx, first + match_len, common_len - match_len);
+        if (open_quote) ctshell_complete_insert(ctx, &open_quote, 1);
+        ctshell_complete_insert(ctx, " ", 1);
+    } else if (count > 1 && common_len > match_len) {
+        ctshell_complete_insert(ctx, first + match_len, common_len - match_len);
+    } else {
+        return count > 1;
+    }
+    return 0;
+}
 
-    char *argv[CONFIG_CTSHELL_MAX_ARGS];
-    int argc = 0;
-    char *p = buf_copy;
-    while (*p && argc < CONFIG_CTSHELL_MAX_ARGS) {
-        while (*p == ' ') *p++ = '\0';
-        if (*p == '\0') break;
-        argv[argc++] = p;
-        while (*p != '\0' && *p != ' ') p++;
+static void ctshell_complete_redraw(ctshell_ctx_t *ctx) {
+    ctshell_puts(ctx, "\r\n" CONFIG_CTSHELL_PROMPT);
+    line_write(ctx, 0, ctx->line_len);
+    view_left(ctx, ctx->line_len - ctx->cur_pos);
+}
+
+static int spec_completes(const ctshell_arg_spec_t *sp, const char *prefix, int prefix_len, int verbs) {
+    if (sp->type == CTSHELL_ARG_VERB && !verbs) return 0;
+    return strncmp(sp->flag, prefix, prefix_len) == 0;
+}
+
+/* completes from the schema of `cmd`, verbs only as its first argument */
+static void ctshell_complete_args(ctshell_ctx_t *ctx, const ctshell_cmd_t *cmd, const char *prefix,
+                                  int prefix_len, char open_quote, int verbs) {
+    const char *first_match = NULL;
+    int match_count = 0;
+    int common_len = 0;
+    for (int i = 0; i < cmd->nargs; i++) {
+        const char *flag = cmd->args[i].flag;
+        if (!spec_completes(&cmd->args[i], prefix, prefix_len, verbs)) continue;
+        if (!first_match) {
+            first_match = flag;
+            common_len = strlen(flag);
+        } else {
+            int n = prefix_len;
+            while (n < common_len && flag[n] == first_match[n]) n++;
+            common_len = n;
+        }
+        match_count++;
+    }
+    if (!ctshell_complete_apply(ctx, first_match, prefix_len, common_len, match_count, open_quote)) return;
+    ctshell_puts(ctx, "\r\n");
+    for (int i = 0; i < cmd->nargs; i++) {
+        if (spec_completes(&cmd->args[i], prefix, prefix_len, verbs)) {
+            ctshell_printf("%s   ", cmd->args[i].flag);
+        }
     }
+    ctshell_complete_redraw(ctx);
+}
+
+static void ctshell_tab_complete(ctshell_ctx_t *ctx) {
+    if (ctx->cur_pos == 0) return;
 
+    /*
+     * complete words before the cursor must name menus, an open one is the
+     * prefix to complete; past a command with a schema they are its arguments
+     */
     const ctshell_cmd_t *parent_cmd = NULL;
-    char *match_prefix = "";
+    const ctshell_cmd_t *arg_cmd = NULL;
+    int arg_words = 0;
+    int want_value = 0;
+    char match_prefix[CONFIG_CTSHELL_CMD_NAME_MAX_LEN] = "";
     int match_len = 0;
-    int has_space = is_trailing_space(ctx->line_buf);
-
-    int parse_depth = has_space ? argc : (argc - 1);
-    int valid_path = 1;
-    for (int i = 0; i < parse_depth; i++) {
-        const ctshell_cmd_t *found = find_cmd_in_section(argv[i], parent_cmd);
-        if (found && ctshell_is_menu(found)) {
-            parent_cmd = found;
-        } else {
-            valid_path = 0;
+    char open_quote = 0;
+    ctshell_tok_t tok;
+    ctshell_span_t span;
+    tok_init(&tok, ctx->line_buf, ctx->cur_pos);
+    while (tok_next(&tok, &span)) {
+        // a word longer than any command name matches nothing
+        match_len = span_unescape(ctx->line_buf, &span, match_prefix, sizeof(match_prefix));
+        if (span.open) {
+            if (match_len < 0) return;
+            open_quote = span.quote;
             break;
         }
+        if (arg_cmd) {
+            // the word after a flag taking a value is that value, never a flag
+            const ctshell_arg_spec_t *sp = NULL;
+            if (match_len >= 0 && !want_value) sp = find_spec(arg_cmd, match_prefix, 0);
+            want_value = sp && sp->type != CTSHELL_ARG_BOOL;
+            arg_words++;
+        } else {
+            if (match_len < 0) return;
+            const ctshell_cmd_t *found = find_cmd_in_section(match_prefix, parent_cmd);
+            if (!found) return;
+            if (ctshell_is_menu(found)) {
+                parent_cmd = found;
+            } else if (found->nargs) {
+                arg_cmd = found;
+            } else {
+                return;
+            }
+        }
+        match_prefix[0] = '\0';
+        match_len = 0;
     }
-    if (!valid_path) return;
-    if (!has_space && argc > 0) {
-        match_prefix = argv[argc - 1];
+    if (arg_cmd) {
+        if (!want_value) ctshell_complete_args(ctx, arg_cmd, match_prefix, match_len, open_quote, arg_words == 0);
+        return;
     }
-    match_len = strlen(match_prefix);
-    const ctshell_cmd_t *cmd = CMD_START;
-    const ctshell_cmd_t *end = CMD_END;
+
+    ctshell_cmd_iter_t it;
+    const ctshell_cmd_t *cmd;
+    const ctshell_cmd_t *first_match = NULL;
     int match_count = 0;
-    const ctshell_cmd_t *last_match = NULL;
-    for (; cmd < end; cmd++) {
-        if (cmd->parent == parent_cmd &&
-            strncmp(cmd->name, match_prefix, match_len) == 0 &&
-            !(cmd->attrs & CTSHELL_ATTR_HIDDEN)) {
-            last_match = cmd;
-            match_count++;
-        }
-    }
-    if (match_count == 1) {
-        const char *full_name = last_match->name;
-        int full_len = strlen(full_name);
-        for (int i = match_len; i < full_len; i++) {
-            if (ctx->line_len < CONFIG_CTSHELL_LINE_BUF_SIZE - 2) {
-                char c = full_name[i];
-                ctshell_write(ctx, &c, 1);
-                ctx->line_buf[ctx->line_len++] = c;
-                ctx->cur_pos++;
-            }
+    int common_len = 0;
+    ctshell_cmd_iter_init_prefix(&it, parent_cmd, match_prefix, match_len);
+    while ((cmd = ctshell_cmd_iter_next(&it)) != NULL) {
+        if (cmd->attrs & CTSHELL_ATTR_HIDDEN) continue;
+        if (!first_match) {
+            first_match = cmd;
+            common_len = strlen(cmd->name);
+        } else {
+            int n = match_len;
+            while (n < common_len && cmd->name[n] == first_match->name[n]) n++;
+            common_len = n;
         }
-        if (ctx->line_len < CONFIG_CTSHELL_LINE_BUF_SIZE - 1) {
-            ctshell_write(ctx, " ", 1);
-            ctx->line_buf[ctx->line_len++] = ' ';
-            ctx->cur_pos++;
-        }
-    } else if (match_count > 1) {
-        ctshell_puts(ctx, "\r\n");
-        for (cmd = CMD_START; cmd < end; cmd++) {
-            if (cmd->parent == parent_cmd &&
-                strncmp(cmd->name, match_prefix, match_len) == 0 &&
-                !(cmd->attrs & CTSHELL_ATTR_HIDDEN)) {
-                if (ctshell_is_menu(cmd)) {
-                    ctshell_printf("%s/  ", cmd->name);
-                } else {
-                    ctshell_printf("%s   ", cmd->name);
-                }
-            }
+        match_count++;
+    }
+    if (!ctshell_complete_apply(ctx, first_match ? first_match->name : NULL, match_len, common_len,
+                                match_count, open_quote)) {
+        return;
+    }
+    ctshell_puts(ctx, "\r\n");
+    ctshell_cmd_iter_init_prefix(&it, parent_cmd, match_prefix, match_len);
+    while ((cmd = ctshell_cmd_iter_next(&it)) != NULL) {
+        if (cmd->attrs & CTSHELL_ATTR_HIDDEN) continue;
+        if (ctshell_is_menu(cmd)) {
+            ctshell_printf("%s/  ", cmd->name);
+        } else {
+            ctshell_printf("%s   ", cmd->name);
         }
-        ctshell_puts(ctx, "\r\n" CONFIG_CTSHELL_PROMPT);
-        ctshell_puts(ctx, ctx->line_buf);
     }
+    ctshell_complete_redraw(ctx);
 }
 
-static void ctshell_exec(ctshell_ctx_t *ctx, int save_history) {
-    ctx->sigint = 0;
-    if (save_history) {
-        ctshell_save_history(ctx);
+#ifdef CONFIG_CTSHELL_USE_STATS
+static inline ctshell_stats_mark_t stats_now(ctshell_ctx_t *ctx) {
+    ctshell_stats_mark_t m;
+    m.tick = ctx->io.get_tick ? ctx->io.get_tick() : 0;
+    m.cycles = ctx->io.get_cycles && ctx->io.cycles_hz ? ctx->io.get_cycles() : 0;
+    return m;
+}
+
+/* microseconds since `start`; past half a counter period the cycles may have wrapped, ticks are used */
+static uint32_t stats_elapsed_us(ctshell_ctx_t *ctx, ctshell_stats_mark_t start) {
+    ctshell_stats_mark_t now = stats_now(ctx);
+    uint64_t us;
+    uint32_t ms = now.tick - start.tick;
+    if (ctx->io.get_cycles && ctx->io.cycles_hz &&
+        ms < ((uint64_t) 1 << 32) * 1000 / ctx->io.cycles_hz / 2) {
+        us = (uint64_t) (now.cycles - start.cycles) * 1000000 / ctx->io.cycles_hz;
+    } else {
+        us = (uint64_t) ms * 1000;
     }
-    if (ctx->line_len == 0) return;
-    ctshell_expand_vars(ctx);
-    char *argv[CONFIG_CTSHELL_MAX_ARGS];
-    int argc = 0;
-    char *p = ctx->line_buf;
-    while (*p && argc < CONFIG_CTSHELL_MAX_ARGS) {
-        while (*p == ' ') *p++ = '\0';
-        if (*p == '\0') break;
-        if (*p == '"') {
-            p++;
-            argv[argc++] = p;
-            while (*p != '\0' && *p != '"') p++;
-            if (*p == '"') *p++ = '\0';
-        } else {
-            argv[argc++] = p;
-            while (*p != '\0' && *p != ' ') p++;
-        }
+    return us < UINT32_MAX ? (uint32_t) us : UINT32_MAX;
+}
+
+static void stats_record(ctshell_ctx_t *ctx, const ctshell_cmd_t *cmd, ctshell_stats_mark_t start,
+                         uint32_t out_start, int aborted) {
+    size_t id = (size_t) (cmd - CMD_START);
+    if (id >= CONFIG_CTSHELL_STATS_SIZE) {
+        ctx->stats_dropped++;
+        return;
     }
-    if (argc == 0) return;
+
+    ctshell_cmd_stats_t *st = &ctx->stats[id];
+    uint32_t elapsed = stats_elapsed_us(ctx, start);
+    if (st->count == 0 || elapsed < st->min) st->min = elapsed;
+    if (elapsed > st->max) st->max = elapsed;
+    st->count++;
+    st->total += elapsed;
+    st->aborts += aborted;
+    st->out_bytes += ctx->out_bytes - out_start;
+}
+#endif
+
+/* walks menus down argv, `*arg_idx` ends at the resolved command's own name */
+static const ctshell_cmd_t *ctshell_resolve(int argc, char *argv[], int *arg_idx) {
     const ctshell_cmd_t *cur_cmd = NULL;
     const ctshell_cmd_t *parent_cmd = NULL;
-    int arg_idx = 0;
-    while (arg_idx < argc) {
-        const ctshell_cmd_t *found = find_cmd_in_section(argv[arg_idx], parent_cmd);
+    int idx = 0;
+    while (idx < argc) {
+        const ctshell_cmd_t *found = find_cmd_in_section(argv[idx], parent_cmd);
         if (found) {
             cur_cmd = found;
-            if (ctshell_is_menu(cur_cmd) && (arg_idx + 1 < argc)) {
-                const ctshell_cmd_t *child = find_cmd_in_section(argv[arg_idx + 1], cur_cmd);
+            if (ctshell_is_menu(cur_cmd) && (idx + 1 < argc)) {
+                const ctshell_cmd_t *child = find_cmd_in_section(argv[idx + 1], cur_cmd);
                 if (child) {
                     parent_cmd = cur_cmd;
-                    arg_idx++;
+                    idx++;
                     continue;
                 }
             }
@@ -356,80 +1648,925 @@ static void ctshell_exec(ctshell_ctx_t *ctx, int save_history) {
             break;
         }
     }
+    *arg_idx = idx;
+    return cur_cmd;
+}
+
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+/* the command table stores every function as ctshell_cmd_func_t */
+#define CMD_ASYNC_FUNC(cmd) ((ctshell_async_func_t) (void (*)(void)) (cmd)->func)
+
+static inline int job_tick_reached(ctshell_ctx_t *ctx, uint32_t tick) {
+    return !ctx->io.get_tick || (int32_t) (ctx->io.get_tick() - tick) >= 0;
+}
+
+static void job_copy_args(ctshell_job_t *job, int argc, char *argv[]) {
+    int pos = 0;
+    job->argc = 0;
+    job->argv = job->argv_buf;
+    for (int i = 0; i < argc && i < CONFIG_CTSHELL_MAX_ARGS; i++) {
+        int len = strlen(argv[i]);
+        if (pos + len + 1 > (int) sizeof(job->arg_buf)) break;
+        memcpy(&job->arg_buf[pos], argv[i], len + 1);
+        job->argv_buf[job->argc++] = &job->arg_buf[pos];
+        pos += len + 1;
+    }
+}
+
+static inline int job_id(const ctshell_ctx_t *ctx, const ctshell_job_t *job) {
+    return (int) (job - ctx->jobs) + 1;
+}
+
+static void job_finish(ctshell_ctx_t *ctx, ctshell_job_t *job, int aborted) {
+#ifdef CONFIG_CTSHELL_USE_STATS
+    stats_record(ctx, job->cmd, job->stats_start, ctx->out_bytes - job->stats_out, aborted);
+#else
+    CTSHELL_UNUSED_PARAM(aborted);
+#endif
+    job->active = 0;
+    if (ctx->fg == job) ctx->fg = NULL;
+}
+
+static int job_step(ctshell_ctx_t *ctx, ctshell_job_t *job) {
+#ifdef CONFIG_CTSHELL_USE_STATS
+    uint32_t out = ctx->out_bytes;
+#endif
+    const ctshell_cmd_t *outer_cmd = ctx->cmd;
+    job->sleeping = 0;
+    ctx->cmd = job->cmd;
+    int rc = CMD_ASYNC_FUNC(job->cmd)(job);
+    ctx->cmd = outer_cmd;
+#ifdef CONFIG_CTSHELL_USE_STATS
+    job->stats_out += ctx->out_bytes - out;
+#endif
+    if (rc != CTSHELL_PENDING) job_finish(ctx, job, 0);
+    return rc;
+}
+
+static void job_cancel(ctshell_ctx_t *ctx, ctshell_job_t *job) {
+    if (job->cleanup) job->cleanup(job);
+    job_finish(ctx, job, 1);
+}
+
+/* a reader inside a pipeline, driven by its writer and not a job of its own */
+static inline int job_is_stage(const ctshell_job_t *job) {
+#ifdef CONFIG_CTSHELL_USE_PIPE
+    return job->in != NULL;
+#else
+    CTSHELL_UNUSED_PARAM(job);
+    return 0;
+#endif
+}
+
+/* a job `jobs`, `fg` and `kill` see */
+static inline int job_listed(const ctshell_ctx_t *ctx, const ctshell_job_t *job) {
+    return job->active && job != ctx->fg && !job_is_stage(job);
+}
+
+static void job_report(ctshell_ctx_t *ctx, const ctshell_job_t *job, const char *status) {
+    ctshell_printf("[%d] %-8s", job_id(ctx, job), status);
+    for (int i = 0; i < job->argc; i++) {
+        ctshell_printf(" %s", job->argv[i]);
+    }
+    ctshell_puts(ctx, "\r\n");
+}
+
+/* claims a free slot, the job counts as started from here on */
+static ctshell_job_t *job_alloc(ctshell_ctx_t *ctx, const ctshell_cmd_t *cmd) {
+    for (int i = 0; i < CONFIG_CTSHELL_JOB_MAX; i++) {
+        ctshell_job_t *job = &ctx->jobs[i];
+        if (job->active) continue;
+        memset(job, 0, sizeof(*job));
+        job->ctx = ctx;
+        job->cmd = cmd;
+#ifdef CONFIG_CTSHELL_USE_STATS
+        job->stats_start = stats_now(ctx);
+#endif
+        job->active = 1;
+        return job;
+    }
+    return NULL;
+}
+
+/*
+ * Starts a job in a free slot, it runs until its first yield right away.
+ * A foreground job takes over the console until it ends.
+ */
+static int job_start(ctshell_ctx_t *ctx, const ctshell_cmd_t *cmd, int argc, char *argv[], int background) {
+    ctshell_job_t *job = job_alloc(ctx, cmd);
+    if (!job) {
+        ctshell_printf("%s: too many jobs\r\n", cmd->name);
+        return -1;
+    }
+    job_copy_args(job, argc, argv);
+    if (background) {
+        job_report(ctx, job, "Started");
+    } else {
+        ctx->fg = job;
+    }
+    int rc = job_step(ctx, job);
+    if (background && rc != CTSHELL_PENDING) job_report(ctx, job, "Done");
+    return rc;
+}
+
+/* sleeps until a job that is not due yet wants to run */
+static void job_idle(ctshell_ctx_t *ctx, const ctshell_job_t *job) {
+    if (!job->sleeping || !ctx->io.idle) return;
+    int32_t left = (int32_t) (job->wake - ctx->io.get_tick());
+    if (left > 0) ctx->io.idle((uint32_t) left, ctx->priv);
+}
+
+/*
+ * Inside another command (`sh`, `time`) there is no poll loop to come back
+ * to, so the job is driven to completion here and Ctrl+C unwinds as usual.
+ */
+static int job_run_sync(ctshell_ctx_t *ctx, const ctshell_cmd_t *cmd, int argc, char *argv[]) {
+    ctshell_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.ctx = ctx;
+    job.cmd = cmd;
+    job.argc = argc;
+    job.argv = argv;
+
+    for (;;) {
+        job.sleeping = 0;
+        int rc = CMD_ASYNC_FUNC(cmd)(&job);
+        if (rc != CTSHELL_PENDING) return rc;
+        ctshell_flush(ctx);
+        do {
+            if (ctx->sigint) {
+                if (job.cleanup) job.cleanup(&job);
+                ctshell_check_abort(ctx);
+            }
+            job_idle(ctx, &job);
+        } while (job.sleeping && !job_tick_reached(ctx, job.wake));
+    }
+}
+
+static inline int job_due(ctshell_ctx_t *ctx, const ctshell_job_t *job) {
+    return !job->sleeping || job_tick_reached(ctx, job->wake);
+}
+
+/* resumes or cancels the foreground job, returns 1 once it has ended */
+static int job_poll_fg(ctshell_ctx_t *ctx) {
+    ctshell_job_t *job = ctx->fg;
+    if (ctx->sigint) {
+        ctx->sigint = 0;
+        job_cancel(ctx, job);
+        ctshell_printf("\r\n^C\r\nCommand aborted.\r\n");
+        return 1;
+    }
+    if (!job_due(ctx, job)) return 0;
+    return job_step(ctx, job) != CTSHELL_PENDING;
+}
+
+/* put the prompt and the edit line back once background output has moved past them */
+static void job_restore_line(ctshell_ctx_t *ctx) {
+    ctx->line_hidden = 0;
+    if (!ctx->hidden_eol) ctshell_puts(ctx, "\r\n");
+    ctshell_puts(ctx, CONFIG_CTSHELL_PROMPT);
+    line_write(ctx, 0, ctx->line_len);
+    view_left(ctx, ctx->line_len - ctx->cur_pos);
+}
+
+/*
+ * Background jobs share the console with the line being edited: the line is
+ * erased before a job's first byte of output and redrawn below it once all
+ * due jobs have run, so a job that prints nothing costs no output.
+ */
+static void job_poll_background(ctshell_ctx_t *ctx) {
+    for (int i = 0; i < CONFIG_CTSHELL_JOB_MAX; i++) {
+        ctshell_job_t *job = &ctx->jobs[i];
+        if (!job_listed(ctx, job) || !job_due(ctx, job)) continue;
+        // with a foreground job, local echo or quiet mode there is no line on screen to protect
+        ctx->hide_line = !ctx->fg && !ctx->no_echo && !ctx->quiet && !ctx->line_hidden;
+        if (job_step(ctx, job) != CTSHELL_PENDING) job_report(ctx, job, "Done");
+        ctx->hide_line = 0;
+    }
+    if (ctx->line_hidden) job_restore_line(ctx);
+}
+
+static ctshell_job_t *job_lookup(ctshell_ctx_t *ctx, int argc, char *argv[]) {
+    if (argc < 2) {
+        // the most recently started background job
+        for (int i = CONFIG_CTSHELL_JOB_MAX - 1; i >= 0; i--) {
+            if (job_listed(ctx, &ctx->jobs[i])) return &ctx->jobs[i];
+        }
+        ctshell_printf("%s: no current job\r\n", argv[0]);
+        return NULL;
+    }
+    const char *id = argv[1][0] == '%' ? argv[1] + 1 : argv[1];
+    int n = atoi(id);
+    if (n < 1 || n > CONFIG_CTSHELL_JOB_MAX || !ctx->jobs[n - 1].active || job_is_stage(&ctx->jobs[n - 1])) {
+        ctshell_printf("%s: %s: no such job\r\n", argv[0], argv[1]);
+        return NULL;
+    }
+    return &ctx->jobs[n - 1];
+}
+
+void ctshell_job_sleep(ctshell_job_t *job, uint32_t ms) {
+    // without a clock the job simply resumes on the next poll
+    if (!job->ctx->io.get_tick) return;
+    job->wake = job->ctx->io.get_tick() + ms;
+    job->sleeping = 1;
+}
+#endif
+
+#ifdef CONFIG_CTSHELL_USE_PIPE
+/*
+ * Pipelines run to completion inside ctshell_exec like any other command
+ * line. Every command after a `|` is an asynchronous job stepped by its
+ * writer: whenever the pipe between them is full, and once the writer has
+ * ended. Memory use is the pipe buffers, whatever the amount of data.
+ */
+static void pipe_step(ctshell_ctx_t *ctx, ctshell_job_t *job) {
+    ctshell_check_abort(ctx);
+    if (!job_due(ctx, job)) {
+        job_idle(ctx, job);
+        return;
+    }
+    ctshell_pipe_t *out = ctx->out_pipe;
+    ctx->out_pipe = job->out;
+    job_step(ctx, job);
+    ctx->out_pipe = out;
+}
+
+static void pipe_write(ctshell_ctx_t *ctx, ctshell_pipe_t *p, const char *str, int len) {
+    // once the reader has ended the rest is dropped
+    while (len > 0 && p->reader->active) {
+        if (p->start > 0 && p->start + p->len == CONFIG_CTSHELL_PIPE_BUF_SIZE) {
+            memmove(p->buf, &p->buf[p->start], p->len);
+            p->start = 0;
+        }
+        int room = CONFIG_CTSHELL_PIPE_BUF_SIZE - p->start - p->len;
+        if (room == 0) {
+            // backpressure, the writer waits here until the reader made room
+            pipe_step(ctx, p->reader);
+            continue;
+        }
+        int n = len < room ? len : room;
+        memcpy(&p->buf[p->start + p->len], str, n);
+        p->len += n;
+        str += n;
+        len -= n;
+    }
+}
+
+static void pipe_flush(ctshell_ctx_t *ctx, ctshell_pipe_t *p) {
+    for (; p; p = p->reader->out) {
+        while (p->len > 0 && p->reader->active && job_due(ctx, p->reader)) {
+            uint16_t len = p->len;
+            pipe_step(ctx, p->reader);
+            if (p->len == len) break; // waiting for more, e.g. the rest of a line
+        }
+    }
+}
+
+/* end of input for the reader, which then runs until it ends as well */
+static void pipe_close(ctshell_ctx_t *ctx, ctshell_pipe_t *p) {
+    p->eof = 1;
+    while (p->reader->active) {
+        pipe_step(ctx, p->reader);
+    }
+}
+
+static void pipe_consume(ctshell_pipe_t *p, int n) {
+    p->start += n;
+    p->len -= n;
+    if (p->len == 0) p->start = 0;
+}
+
+int ctshell_job_read(ctshell_job_t *job, char *buf, int len) {
+    ctshell_pipe_t *p = job->in;
+    if (!p || (p->len == 0 && p->eof)) return CTSHELL_EOF;
+    int n = len < p->len ? len : p->len;
+    memcpy(buf, &p->buf[p->start], n);
+    pipe_consume(p, n);
+    return n;
+}
+
+int ctshell_job_readline(ctshell_job_t *job, const char **line) {
+    ctshell_pipe_t *p = job->in;
+    if (!p || (p->len == 0 && p->eof)) return CTSHELL_EOF;
+    const char *s = &p->buf[p->start];
+    const char *nl = memchr(s, '\n', p->len);
+    int n;
+    if (nl) {
+        n = (int) (nl - s) + 1;
+    } else if (p->eof || p->len == CONFIG_CTSHELL_PIPE_BUF_SIZE) {
+        // the last line, or one longer than the pipe
+        n = p->len;
+    } else {
+        return 0;
+    }
+    // consumed data stays in place until the writer runs again
+    *line = s;
+    pipe_consume(p, n);
+    return n;
+}
+
+/* returns the return code of the first command, the readers' codes are not kept */
+static int pipe_run(ctshell_ctx_t *ctx, const ctshell_cmd_t *cmds[], int argc[], char **argv[], int n) {
+    jmp_buf outer;
+    int was_executing = ctx->is_executing;
+    int rc;
+
+    for (int i = 1; i < n; i++) {
+        ctshell_job_t *job = job_alloc(ctx, cmds[i]);
+        if (!job) {
+            ctshell_printf("%s: too many jobs\r\n", cmds[i]->name);
+            for (int j = 1; j < i; j++) {
+                ctx->pipes[j - 1].reader->active = 0;
+                ctx->pipes[j - 1].reader = NULL;
+            }
+            return -1;
+        }
+        // the line buffer stays untouched until the pipeline has ended
+        job->argc = argc[i];
+        job->argv = argv[i];
+        ctshell_pipe_t *p = &ctx->pipes[i - 1];
+        memset(p, 0, offsetof(ctshell_pipe_t, buf));
+        p->reader = job;
+        job->in = p;
+        job->out = i < n - 1 ? &ctx->pipes[i] : NULL;
+    }
+
+    const ctshell_cmd_t *outer_cmd = ctx->cmd;
+    if (was_executing) memcpy(outer, ctx->jump_env, sizeof(jmp_buf));
+#ifdef CONFIG_CTSHELL_USE_STATS
+    ctshell_stats_mark_t stats_start = stats_now(ctx);
+    uint32_t stats_out = ctx->out_bytes;
+    int aborted = 0;
+#endif
+    ctx->is_executing = 1;
+    ctx->cmd = cmds[0];
+    if (setjmp(ctx->jump_env) == 0) {
+        ctx->out_pipe = &ctx->pipes[0];
+        if (cmds[0]->attrs & CTSHELL_ATTR_ASYNC) {
+            rc = job_run_sync(ctx, cmds[0], argc[0], argv[0]);
+        } else {
+            rc = cmds[0]->func(argc[0], argv[0]);
+        }
+        ctx->out_pipe = NULL;
+        for (int i = 0; i < n - 1; i++) {
+            pipe_close(ctx, &ctx->pipes[i]);
+        }
+    } else {
+        ctx->out_pipe = NULL;
+        ctshell_printf("\r\n^C\r\nCommand aborted.\r\n");
+        rc = -1;
+#ifdef CONFIG_CTSHELL_USE_STATS
+        aborted = 1;
+#endif
+    }
+    for (int i = 0; i < n - 1; i++) {
+        ctshell_pipe_t *p = &ctx->pipes[i];
+        if (p->reader->active) job_cancel(ctx, p->reader);
+        p->reader = NULL;
+    }
+    ctx->is_executing = was_executing;
+    ctx->cmd = outer_cmd;
+    if (was_executing) memcpy(ctx->jump_env, outer, sizeof(jmp_buf));
+#ifdef CONFIG_CTSHELL_USE_STATS
+    stats_record(ctx, cmds[0], stats_start, stats_out, aborted);
+#endif
+    return rc;
+}
+#endif
+
+/*
+ * Calls a resolved command; Ctrl+C unwinds back here. A nested run (`time`,
+ * `sh`) restores the caller's jump target so an abort after it returns
+ * still lands in a live frame.
+ */
+static int ctshell_run(ctshell_ctx_t *ctx, const ctshell_cmd_t *cmd, int argc, char *argv[]) {
+    jmp_buf outer;
+    int was_executing = ctx->is_executing;
+    int rc;
+
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+    int is_async = (cmd->attrs & CTSHELL_ATTR_ASYNC) != 0;
+    // redirected, framed or quiet output is complete once the command returns, so it runs here
+    if (is_async && !was_executing && !OUT_REDIRECTED(ctx) && !RPC_OPEN(ctx) && !ctx->quiet) {
+        return job_start(ctx, cmd, argc, argv, 0);
+    }
+#endif
+    const ctshell_cmd_t *outer_cmd = ctx->cmd;
+    if (was_executing) memcpy(outer, ctx->jump_env, sizeof(jmp_buf));
+#ifdef CONFIG_CTSHELL_USE_STATS
+    // neither is written between setjmp and longjmp, so both survive an abort
+    ctshell_stats_mark_t stats_start = stats_now(ctx);
+    uint32_t stats_out = ctx->out_bytes;
+    int aborted = 0;
+#endif
+    ctx->is_executing = 1;
+    ctx->cmd = cmd;
+    if (setjmp(ctx->jump_env) == 0) {
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+        rc = is_async ? job_run_sync(ctx, cmd, argc, argv) : cmd->func(argc, argv);
+#else
+        rc = cmd->func(argc, argv);
+#endif
+    } else {
+        ctshell_printf("\r\n^C\r\nCommand aborted.\r\n");
+        rc = -1;
+#ifdef CONFIG_CTSHELL_USE_STATS
+        aborted = 1;
+#endif
+    }
+    ctx->is_executing = was_executing;
+    ctx->cmd = outer_cmd;
+    if (was_executing) memcpy(ctx->jump_env, outer, sizeof(jmp_buf));
+#ifdef CONFIG_CTSHELL_USE_STATS
+    stats_record(ctx, cmd, stats_start, stats_out, aborted);
+#endif
+    return rc;
+}
+
+/* returns the command's return code, -1 if it could not run */
+static int ctshell_dispatch(ctshell_ctx_t *ctx, int argc, char *argv[], int background) {
+    int arg_idx;
+    int rc = -1;
+    const ctshell_cmd_t *cur_cmd = ctshell_resolve(argc, argv, &arg_idx);
     if (cur_cmd) {
         if (cur_cmd->func == NULL) {
             ctshell_printf("\r\nCommand group '%s'. Sub-commands:\r\n", cur_cmd->name);
-            const ctshell_cmd_t *c = CMD_START;
-            for (; c < CMD_END; c++) {
-                if (c->parent == cur_cmd && !(c->attrs & CTSHELL_ATTR_HIDDEN)) {
+            ctshell_cmd_iter_t it;
+            const ctshell_cmd_t *c;
+            ctshell_cmd_iter_init(&it, cur_cmd);
+            while ((c = ctshell_cmd_iter_next(&it)) != NULL) {
+                if (!(c->attrs & CTSHELL_ATTR_HIDDEN)) {
                     ctshell_printf("  %-12s : %s\r\n", c->name, c->desc);
                 }
             }
-        } else {
+        } else if (background) {
             ctshell_puts(ctx, "\r\n");
-            ctx->is_executing = 1;
-            if (setjmp(ctx->jump_env) == 0) {
-                cur_cmd->func(argc - arg_idx, &argv[arg_idx]);
-            } else {
-                ctshell_printf("\r\n^C\r\nCommand aborted.\r\n");
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+            if (cur_cmd->attrs & CTSHELL_ATTR_ASYNC) {
+                // a job that has not ended yet has started successfully
+                rc = job_start(ctx, cur_cmd, argc - arg_idx, &argv[arg_idx], 1);
+                if (rc == CTSHELL_PENDING) rc = 0;
+            } else
+#endif
+            {
+                ctshell_printf("%s: cannot run in the background\r\n", cur_cmd->name);
             }
-            ctx->is_executing = 0;
+        } else {
+            // ends the echoed line; a script line of a redirected `sh` has none in the file
+            if (!OUT_REDIRECTED(ctx)) ctshell_puts(ctx, "\r\n");
+#ifdef CONFIG_CTSHELL_USE_FS
+            if (ctx->sink.open) ctx->out_file = &ctx->sink;
+#endif
+            rc = ctshell_run(ctx, cur_cmd, argc - arg_idx, &argv[arg_idx]);
+            ctshell_flush(ctx);
+        }
+    } else {
+        ctshell_printf("\r\n%s: command not found", argv[arg_idx]);
+    }
+    return rc;
+}
+
+#if defined(CONFIG_CTSHELL_USE_ASYNC) || defined(CONFIG_CTSHELL_USE_FS)
+/* an unquoted operator token; quoted and escaped arguments start right after their quote or '\\' */
+static int arg_is_op(const char *arg, const char *op) {
+    return strcmp(arg, op) == 0 && arg[-1] != '"' && arg[-1] != '\'' && arg[-1] != '\\';
+}
+#endif
+
+#ifdef CONFIG_CTSHELL_USE_PIPE
+static int ctshell_pipeline(ctshell_ctx_t *ctx, int argc, char *argv[], int background) {
+    const ctshell_cmd_t *cmds[CONFIG_CTSHELL_PIPE_MAX + 1];
+    int cmd_argc[CONFIG_CTSHELL_PIPE_MAX + 1];
+    char **cmd_argv[CONFIG_CTSHELL_PIPE_MAX + 1];
+    int n = 0;
+    int start = 0;
+
+    if (background) {
+        ctshell_printf("\r\npipelines cannot run in the background");
+        return -1;
+    }
+    if (ctx->pipes[0].reader) {
+        ctshell_printf("\r\npipelines cannot be nested");
+        return -1;
+    }
+    for (int i = 0; i <= argc; i++) {
+        if (i < argc && !arg_is_op(argv[i], "|")) continue;
+        if (i == start) {
+            ctshell_printf("\r\nsyntax error near '|'");
+            return -1;
+        }
+        if (n == CONFIG_CTSHELL_PIPE_MAX + 1) {
+            ctshell_printf("\r\ntoo many pipes");
+            return -1;
+        }
+        int arg_idx;
+        const ctshell_cmd_t *cmd = ctshell_resolve(i - start, &argv[start], &arg_idx);
+        if (!cmd) {
+            ctshell_printf("\r\n%s: command not found", argv[start + arg_idx]);
+            return -1;
+        }
+        if (!cmd->func) {
+            ctshell_printf("\r\n%s: is a command group", cmd->name);
+            return -1;
+        }
+        if (n > 0 && !(cmd->attrs & CTSHELL_ATTR_ASYNC)) {
+            ctshell_printf("\r\n%s: cannot read from a pipe", cmd->name);
+            return -1;
+        }
+        cmds[n] = cmd;
+        cmd_argc[n] = i - start - arg_idx;
+        cmd_argv[n] = &argv[start + arg_idx];
+        n++;
+        start = i + 1;
+    }
+    if (!OUT_REDIRECTED(ctx)) ctshell_puts(ctx, "\r\n");
+#ifdef CONFIG_CTSHELL_USE_FS
+    if (ctx->sink.open) ctx->out_file = &ctx->sink;
+#endif
+    int rc = pipe_run(ctx, cmds, cmd_argc, cmd_argv, n);
+    ctshell_flush(ctx);
+    return rc;
+}
+#endif
+
+#ifdef CONFIG_CTSHELL_USE_FS
+/*
+ * Strips a trailing `> file` or `>> file` and opens the file; the command
+ * writes to it once it starts. Returns 1 if the file was opened, 0 if the
+ * line has no redirection and -1 if it must not run.
+ */
+static int redirect_open(ctshell_ctx_t *ctx, int *argc, char *argv[], int background) {
+    int i;
+    int append = 0;
+    for (i = 0; i < *argc; i++) {
+        if (arg_is_op(argv[i], ">")) break;
+        if (arg_is_op(argv[i], ">>")) {
+            append = 1;
+            break;
+        }
+    }
+    if (i == *argc) return 0;
+    if (i == 0 || i != *argc - 2) {
+        ctshell_printf("\r\nsyntax error near '%s'",
+                       i == 0 ? argv[0] : i == *argc - 1 ? "newline" : argv[i + 2]);
+        return -1;
+    }
+    if (background) {
+        ctshell_printf("\r\nbackground jobs cannot be redirected");
+        return -1;
+    }
+    if (!ctx->fs_drv) {
+        ctshell_printf("\r\nError: Filesystem not initialized.");
+        return -1;
+    }
+    if (ctx->sink.open) {
+        ctshell_printf("\r\nredirections cannot be nested");
+        return -1;
+    }
+    char path[CONFIG_CTSHELL_FS_PATH_MAX];
+    ctshell_fs_resolve_path(ctx->cwd, argv[i + 1], path, sizeof(path));
+    int fd = ctx->fs_drv->open(path, append ? CTSHELL_O_APPEND : CTSHELL_O_TRUNC);
+    if (fd < 0) {
+        ctshell_printf("\r\n%s: cannot open file", path);
+        return -1;
+    }
+    if (append && ctx->fs_drv->lseek) {
+        ctx->fs_drv->lseek(fd, 0, SEEK_END);
+    }
+    ctx->sink.fd = fd;
+    ctx->sink.len = 0;
+    ctx->sink.failed = 0;
+    ctx->sink.open = 1;
+    *argc = i;
+    return 1;
+}
+#endif
+
+/* runs one command line, from the edit line or a script; returns the command's return code */
+static int ctshell_exec(ctshell_ctx_t *ctx, const char *src) {
+    ctx->sigint = 0;
+    // argv points into `line`; its first byte stays NUL so arg[-1] is always readable
+    char line[CONFIG_CTSHELL_LINE_BUF_SIZE + 1];
+    line[0] = '\0';
+    int len = ctshell_expand_vars(ctx, src, line + 1, CONFIG_CTSHELL_LINE_BUF_SIZE);
+    if (len <= 0) return len;
+    char *argv[CONFIG_CTSHELL_MAX_ARGS];
+    int argc = 0;
+    ctshell_tok_t tok;
+    ctshell_span_t span;
+    tok_init(&tok, line + 1, len);
+    while (argc < CONFIG_CTSHELL_MAX_ARGS && tok_next(&tok, &span)) {
+        argv[argc++] = span_arg(line + 1, &span);
+    }
+    if (argc == 0) return 0;
+
+    int background = 0;
+    int rc;
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+    if (arg_is_op(argv[argc - 1], "&")) {
+        background = 1;
+        if (--argc == 0) return 0;
+    }
+#endif
+#ifdef CONFIG_CTSHELL_USE_FS
+    // a script line run by a redirected `sh` keeps writing to the outer file
+    int redirected = redirect_open(ctx, &argc, argv, background);
+    if (redirected < 0) return -1;
+#endif
+#ifdef CONFIG_CTSHELL_USE_PIPE
+    int piped = 0;
+    for (int i = 0; i < argc && !piped; i++) {
+        piped = arg_is_op(argv[i], "|");
+    }
+    if (piped) {
+        rc = ctshell_pipeline(ctx, argc, argv, background);
+    } else
+#endif
+    {
+        rc = ctshell_dispatch(ctx, argc, argv, background);
+    }
+#ifdef CONFIG_CTSHELL_USE_FS
+    if (redirected) redirect_close(ctx);
+#endif
+    return rc;
+}
+
+#ifdef CONFIG_CTSHELL_USE_RPC
+#define RPC_HDR_LEN 3 // type and sequence number
+#define RPC_CRC_LEN 2
+#define RPC_COBS_RUN 254
+#define RPC_BAD_MAX 4 // undecodable packets in a row that put the link back in text mode
+
+static void print_cmd_path(const ctshell_cmd_t *cmd);
+
+/* CRC-16/CCITT-FALSE, a nibble at a time */
+static uint16_t rpc_crc16(const uint8_t *p, int len) {
+    static const uint16_t nibble[16] = {
+            0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+            0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    };
+    uint16_t crc = 0xFFFF;
+    while (len-- > 0) {
+        crc = (uint16_t) (crc << 4) ^ nibble[(crc >> 12) ^ (*p >> 4)];
+        crc = (uint16_t) (crc << 4) ^ nibble[(crc >> 12) ^ (*p++ & 0x0F)];
+    }
+    return crc;
+}
+
+/* appends the CRC to buf[0, len), which must have room for it, and sends it COBS encoded */
+static void rpc_send(ctshell_ctx_t *ctx, uint8_t *buf, int len) {
+    uint16_t crc = rpc_crc16(buf, len);
+    buf[len++] = (uint8_t) crc;
+    buf[len++] = (uint8_t) (crc >> 8);
+
+    const uint8_t *p = buf;
+    const uint8_t *end = buf + len;
+    for (;;) {
+        int run = 0;
+        while (p + run < end && p[run] != 0 && run < RPC_COBS_RUN) run++;
+        char code = (char) (run + 1);
+        ctshell_tx_write(ctx, &code, 1);
+        ctshell_tx_write(ctx, (const char *) p, run);
+        p += run;
+        if (p == end) break;
+        // a full run is not followed by an implicit zero
+        if (run < RPC_COBS_RUN) p++;
+    }
+    ctshell_tx_write(ctx, "", 1);
+}
+
+static void rpc_reply(ctshell_ctx_t *ctx, uint8_t type, uint16_t seq, int32_t value) {
+    uint8_t pkt[RPC_HDR_LEN + 4 + RPC_CRC_LEN] = {
+            type, (uint8_t) seq, (uint8_t) (seq >> 8),
+            (uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16), (uint8_t) ((uint32_t) value >> 24),
+    };
+    rpc_send(ctx, pkt, RPC_HDR_LEN + 4);
+}
+
+/* later output goes into packets of `type` tagged with `seq` */
+static void rpc_out_begin(ctshell_ctx_t *ctx, uint8_t type, uint16_t seq) {
+    ctshell_rpc_t *r = &ctx->rpc;
+    r->out[0] = type;
+    r->out[1] = (uint8_t) seq;
+    r->out[2] = (uint8_t) (seq >> 8);
+    r->out_len = RPC_HDR_LEN;
+}
+
+static void rpc_out_flush(ctshell_ctx_t *ctx) {
+    ctshell_rpc_t *r = &ctx->rpc;
+    if (r->out_len > RPC_HDR_LEN) {
+        rpc_send(ctx, r->out, r->out_len);
+        r->out_len = RPC_HDR_LEN;
+    }
+}
+
+static void rpc_out_write(ctshell_ctx_t *ctx, const char *str, int len) {
+    ctshell_rpc_t *r = &ctx->rpc;
+    while (len > 0) {
+        int room = CONFIG_CTSHELL_RPC_FRAME_SIZE - RPC_CRC_LEN - r->out_len;
+        int n = len < room ? len : room;
+        memcpy(&r->out[r->out_len], str, n);
+        r->out_len += n;
+        str += n;
+        len -= n;
+        if (r->out_len == CONFIG_CTSHELL_RPC_FRAME_SIZE - RPC_CRC_LEN) rpc_out_flush(ctx);
+    }
+}
+
+/* points argv[argc..] at the NUL-terminated strings filling s[0, len) */
+static int rpc_split_args(char *s, int len, int argc, char *argv[]) {
+    if (len > 0 && s[len - 1] != '\0') return -1;
+    for (int i = 0; i < len; i += strlen(&s[i]) + 1) {
+        if (argc == CONFIG_CTSHELL_MAX_ARGS) return -1;
+        argv[argc++] = &s[i];
+    }
+    return argc;
+}
+
+static void rpc_run(ctshell_ctx_t *ctx, uint16_t seq, const ctshell_cmd_t *cmd, int argc, char *argv[]) {
+    rpc_out_flush(ctx);
+    rpc_out_begin(ctx, CTSHELL_RPC_OUTPUT, seq);
+    ctx->sigint = 0;
+    int rc = ctshell_run(ctx, cmd, argc, argv);
+    rpc_out_flush(ctx);
+    rpc_out_begin(ctx, CTSHELL_RPC_EVENT, 0);
+    rpc_reply(ctx, CTSHELL_RPC_DONE, seq, rc);
+}
+
+static void rpc_list(ctshell_ctx_t *ctx, uint16_t seq) {
+    rpc_out_flush(ctx);
+    rpc_out_begin(ctx, CTSHELL_RPC_OUTPUT, seq);
+    for (const ctshell_cmd_t *cmd = CMD_START; cmd < CMD_END; cmd++) {
+        if (!cmd->func) continue;
+        ctshell_printf("%u ", (unsigned) (cmd - CMD_START));
+        print_cmd_path(cmd);
+        ctshell_printf("\n");
+    }
+    rpc_out_flush(ctx);
+    rpc_out_begin(ctx, CTSHELL_RPC_EVENT, 0);
+    rpc_reply(ctx, CTSHELL_RPC_DONE, seq, 0);
+}
+
+static void rpc_leave(ctshell_ctx_t *ctx) {
+    rpc_out_flush(ctx);
+    ctx->rpc.open = 0;
+    ctx->rpc_mode = 0;
+    ctshell_puts(ctx, "\r\n" CONFIG_CTSHELL_PROMPT);
+}
+
+static void rpc_close(ctshell_ctx_t *ctx, uint16_t seq) {
+    rpc_out_flush(ctx);
+    rpc_reply(ctx, CTSHELL_RPC_DONE, seq, 0);
+    rpc_leave(ctx);
+}
+
+static void rpc_packet(ctshell_ctx_t *ctx) {
+    ctshell_rpc_t *r = &ctx->rpc;
+    int len = r->in_len - RPC_CRC_LEN;
+    uint16_t seq = r->in_len >= RPC_HDR_LEN ? (uint16_t) (r->in[1] | r->in[2] << 8) : 0;
+    if (r->overflow || r->left || len < RPC_HDR_LEN ||
+        rpc_crc16(r->in, len) != (uint16_t) (r->in[len] | r->in[len + 1] << 8)) {
+        rpc_reply(ctx, CTSHELL_RPC_ERROR, seq, CTSHELL_RPC_ERR_FRAME);
+        // whoever is sending this is not speaking RPC, most likely a terminal
+        if (++r->bad == RPC_BAD_MAX) rpc_leave(ctx);
+        return;
+    }
+    r->bad = 0;
+
+    char *payload = (char *) &r->in[RPC_HDR_LEN];
+    len -= RPC_HDR_LEN;
+    char *argv[CONFIG_CTSHELL_MAX_ARGS];
+    int argc;
+    int arg_idx = 0;
+    const ctshell_cmd_t *cmd = NULL;
+    switch (r->in[0]) {
+        case CTSHELL_RPC_CALL_NAME:
+            argc = rpc_split_args(payload, len, 0, argv);
+            if (argc > 0) cmd = ctshell_resolve(argc, argv, &arg_idx);
+            break;
+        case CTSHELL_RPC_CALL_ID: {
+            if (len < 2) {
+                argc = -1;
+                break;
+            }
+            uint16_t id = (uint16_t) ((uint8_t) payload[0] | (uint8_t) payload[1] << 8);
+            argc = rpc_split_args(payload + 2, len - 2, 1, argv);
+            if (id < (size_t) (CMD_END - CMD_START)) {
+                cmd = &CMD_START[id];
+                argv[0] = (char *) cmd->name;
+            }
+            break;
         }
+        case CTSHELL_RPC_LIST:
+            rpc_list(ctx, seq);
+            return;
+        case CTSHELL_RPC_CLOSE:
+            rpc_close(ctx, seq);
+            return;
+        default:
+            rpc_reply(ctx, CTSHELL_RPC_ERROR, seq, CTSHELL_RPC_ERR_TYPE);
+            return;
+    }
+    if (argc < 0) {
+        rpc_reply(ctx, CTSHELL_RPC_ERROR, seq, CTSHELL_RPC_ERR_ARGS);
+    } else if (!cmd || !cmd->func) {
+        rpc_reply(ctx, CTSHELL_RPC_ERROR, seq, CTSHELL_RPC_ERR_NOT_FOUND);
     } else {
-        ctshell_printf("\r\n%s: command not found", argv[arg_idx]);
+        rpc_run(ctx, seq, cmd, argc - arg_idx, &argv[arg_idx]);
     }
 }
 
-static ctshell_key_event_t dfa_parse(ctshell_ctx_t *ctx, char byte) {
-    for (int i = 0; i < (int) DFA_TABLE_SIZE; i++) {
-        if (dfa_table[i].state == ctx->dfa_state && dfa_table[i].input == byte) {
-            ctx->dfa_state = dfa_table[i].next_state;
-            return dfa_table[i].evt;
-        }
+/* consumer side: decodes COBS as it arrives, a 0x00 ends the packet */
+static void rpc_input(ctshell_ctx_t *ctx, uint8_t byte) {
+    ctshell_rpc_t *r = &ctx->rpc;
+    if (byte == 0) {
+        // back-to-back delimiters are idle fill
+        if (r->code) rpc_packet(ctx);
+        r->in_len = r->code = r->left = r->overflow = 0;
+        return;
     }
-
-    if (ctx->dfa_state != CTSHELL_DFA_ROOT) {
-        ctx->dfa_state = CTSHELL_DFA_ROOT;
-        return dfa_parse(ctx, byte);
+    if (r->left == 0) {
+        // a new block, the previous one ended with an implicit zero unless it was a full run
+        uint8_t implicit = r->code && r->code != RPC_COBS_RUN + 1;
+        r->code = byte;
+        r->left = byte - 1;
+        if (!implicit) return;
+        byte = 0;
+    } else {
+        r->left--;
     }
-
-    if (byte >= 32 && byte <= 126) {
-        return CTSHELL_EVT_NORMAL_CHAR;
+    if (r->in_len < CONFIG_CTSHELL_RPC_FRAME_SIZE) {
+        r->in[r->in_len++] = byte;
+    } else {
+        r->overflow = 1;
     }
+}
+
+#if CONFIG_CTSHELL_RPC_TIMEOUT > 0
+/* ms until an unfinished packet times out, CTSHELL_WAIT_FOREVER without one */
+static uint32_t rpc_timeout(ctshell_ctx_t *ctx) {
+    if (!RPC_OPEN(ctx) || !ctx->rpc.code || !ctx->io.get_tick) return CTSHELL_WAIT_FOREVER;
+    int32_t left = (int32_t) (ctx->rpc.rx_tick + CONFIG_CTSHELL_RPC_TIMEOUT - ctx->io.get_tick());
+    return left > 0 ? (uint32_t) left : 0;
+}
+#endif
 
-    return CTSHELL_EVT_NONE;
+static int cmd_rpc(int argc, char *argv[]) {
+    CTSHELL_UNUSED_PARAM(argc);
+    CTSHELL_UNUSED_PARAM(argv);
+    ctshell_ctx_t *ctx = ctshell_current_ctx();
+    ctshell_rpc_t *r = &ctx->rpc;
+    if (RPC_OPEN(ctx) || OUT_REDIRECTED(ctx)) return -1;
+    r->in_len = r->code = r->left = r->overflow = r->bad = 0;
+    rpc_out_begin(ctx, CTSHELL_RPC_EVENT, 0);
+    r->open = 1;
+    ctx->rpc_mode = 1;
+    // the lone 0x00 tells the host where text ends, its packets are answered from here on
+    ctshell_tx_write(ctx, "", 1);
+    return 0;
+}
+CTSHELL_EXPORT_CMD(rpc, cmd_rpc, "Switch the link to RPC packets", CTSHELL_ATTR_NONE);
+#endif
+
+static ctshell_key_event_t dfa_parse(ctshell_ctx_t *ctx, char byte) {
+    uint8_t cell = dfa_table[ctx->dfa_state][(uint8_t) byte];
+    ctx->dfa_state = DFA_NEXT(cell);
+    return DFA_EVT(cell);
 }
 
 static void hdl_normal_char(ctshell_ctx_t *ctx, char byte) {
     if (ctx->line_len < CONFIG_CTSHELL_LINE_BUF_SIZE - 1) {
-        memmove(&ctx->line_buf[ctx->cur_pos + 1], &ctx->line_buf[ctx->cur_pos], ctx->line_len - ctx->cur_pos + 1);
-        ctx->line_buf[ctx->cur_pos] = byte;
+        ctx->line_buf[ctx->cur_pos++] = byte;
         ctx->line_len++;
-        ctx->cur_pos++;
-        ctshell_write(ctx, &byte, 1);
-        ctshell_redraw_tail(ctx);
+        view_insert(ctx, ctx->cur_pos - 1, 1);
     }
 }
 
 static void hdl_enter(ctshell_ctx_t *ctx, char byte) {
     CTSHELL_UNUSED_PARAM(byte);
 
-    ctshell_exec(ctx, 1);
-    ctx->line_len = 0;
-    ctx->cur_pos = 0;
-    memset(ctx->line_buf, 0, CONFIG_CTSHELL_LINE_BUF_SIZE);
+    line_flatten(ctx);
+    ctshell_save_history(ctx);
+    ctshell_exec(ctx, ctx->line_buf);
+    line_reset(ctx);
+    // after `quiet on` the host waits for markers, not for a prompt, after `rpc` for packets
+    if (ctx->quiet || RPC_OPEN(ctx)) return;
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+    // the prompt follows once the job has ended
+    if (ctx->fg) return;
+#endif
     ctshell_puts(ctx, "\r\n" CONFIG_CTSHELL_PROMPT);
+    ctshell_flush(ctx);
 }
 
 static void hdl_backspace(ctshell_ctx_t *ctx, char byte) {
     CTSHELL_UNUSED_PARAM(byte);
 
     if (ctx->cur_pos > 0) {
-        memmove(&ctx->line_buf[ctx->cur_pos - 1], &ctx->line_buf[ctx->cur_pos], ctx->line_len - ctx->cur_pos + 1);
         ctx->cur_pos--;
         ctx->line_len--;
-        ctshell_cursor_left(ctx);
-        ctshell_redraw_tail(ctx);
+        view_left(ctx, 1);
+        view_delete(ctx, ctx->cur_pos, 1);
     }
 }
 
@@ -459,7 +2596,8 @@ static void hdl_cursor_left(ctshell_ctx_t *ctx, char byte) {
 
     if (ctx->cur_pos > 0) {
         ctx->cur_pos--;
-        ctshell_cursor_left(ctx);
+        ctx->line_buf[line_tail(ctx)] = ctx->line_buf[ctx->cur_pos];
+        view_left(ctx, 1);
     }
 }
 
@@ -467,8 +2605,32 @@ static void hdl_cursor_right(ctshell_ctx_t *ctx, char byte) {
     CTSHELL_UNUSED_PARAM(byte);
 
     if (ctx->cur_pos < ctx->line_len) {
+        view_move(ctx, ctx->cur_pos, ctx->cur_pos + 1);
+        ctx->line_buf[ctx->cur_pos] = ctx->line_buf[line_tail(ctx)];
         ctx->cur_pos++;
-        ctshell_cursor_right(ctx);
+    }
+}
+
+static void hdl_home(ctshell_ctx_t *ctx, char byte) {
+    CTSHELL_UNUSED_PARAM(byte);
+
+    view_left(ctx, ctx->cur_pos);
+    line_gap_move(ctx, 0);
+}
+
+static void hdl_end(ctshell_ctx_t *ctx, char byte) {
+    CTSHELL_UNUSED_PARAM(byte);
+
+    view_move(ctx, ctx->cur_pos, ctx->line_len);
+    line_gap_move(ctx, ctx->line_len);
+}
+
+static void hdl_delete(ctshell_ctx_t *ctx, char byte) {
+    CTSHELL_UNUSED_PARAM(byte);
+
+    if (ctx->cur_pos < ctx->line_len) {
+        ctx->line_len--;
+        view_delete(ctx, ctx->cur_pos, 1);
     }
 }
 
@@ -476,9 +2638,7 @@ static void hdl_ctrl_c(ctshell_ctx_t *ctx, char byte) {
     CTSHELL_UNUSED_PARAM(byte);
 
     ctshell_puts(ctx, "\r\n" CONFIG_CTSHELL_PROMPT);
-    ctx->line_len = 0;
-    ctx->cur_pos = 0;
-    memset(ctx->line_buf, 0, CONFIG_CTSHELL_LINE_BUF_SIZE);
+    line_reset(ctx);
 }
 
 static void hdl_tab(ctshell_ctx_t *ctx, char byte) {
@@ -500,8 +2660,55 @@ static const event_handler_t action_map[] = {
         [CTSHELL_EVT_LEFT]        = hdl_cursor_left,
         [CTSHELL_EVT_RIGHT]       = hdl_cursor_right,
         [CTSHELL_EVT_CTRL_C]      = hdl_ctrl_c,
+        [CTSHELL_EVT_HOME]        = hdl_home,
+        [CTSHELL_EVT_END]         = hdl_end,
+        [CTSHELL_EVT_DELETE]      = hdl_delete,
 };
 
+#define QUIET_BEGIN "\x02" // STX, then the sequence number
+#define QUIET_END   "\x03" // ETX, then the sequence number and the return code
+
+/*
+ * Non-interactive input: bytes are stored without echo or editing, and each
+ * non-empty line runs between a begin and an end marker, so a host can send
+ * lines back to back and match the replies by sequence number.
+ */
+static void quiet_input(ctshell_ctx_t *ctx, char byte) {
+    if (byte == '\r' || byte == '\n') {
+        // CR LF pairs and blank lines are not run
+        if (ctx->line_len == 0 && !ctx->quiet_long) return;
+        uint16_t seq = ++ctx->quiet_seq;
+        int rc = -1;
+        line_flatten(ctx);
+        ctshell_printf(QUIET_BEGIN "%u", seq);
+        if (ctx->quiet_long) {
+            ctshell_printf("\r\nline too long");
+        } else {
+            rc = ctshell_exec(ctx, ctx->line_buf);
+        }
+        // the end marker starts a line of its own, also after output without a line break
+        if (!ctx->tx_eol) ctshell_puts(ctx, "\r\n");
+        ctshell_printf(QUIET_END "%u %d\r\n", seq, rc);
+        ctx->quiet_long = 0;
+        line_reset(ctx);
+        // `quiet off` hands the console back
+        if (!ctx->quiet) {
+            ctx->quiet_lf = byte == '\r';
+            ctshell_puts(ctx, "\r\n" CONFIG_CTSHELL_PROMPT);
+        }
+        return;
+    }
+    if (byte == CTSHELL_KEY_CTRL_C) {
+        ctx->quiet_long = 0;
+        line_reset(ctx);
+    } else if (ctx->line_len < CONFIG_CTSHELL_LINE_BUF_SIZE - 1) {
+        ctx->line_buf[ctx->cur_pos++] = byte;
+        ctx->line_len++;
+    } else {
+        ctx->quiet_long = 1;
+    }
+}
+
 static void ctshell_handle_byte(ctshell_ctx_t *ctx, char byte) {
     ctshell_key_event_t evt = dfa_parse(ctx, byte);
 
@@ -513,32 +2720,155 @@ static void ctshell_handle_byte(ctshell_ctx_t *ctx, char byte) {
     }
 }
 
+/* producer side: copies up to `len` bytes with at most two memcpy calls */
+static uint16_t ctshell_fifo_push(ctshell_ctx_t *ctx, const char *data, uint16_t len) {
+    uint32_t head = SHARED_LOAD_RELAXED(&ctx->fifo_head);
+    uint32_t tail = SHARED_LOAD_ACQUIRE(&ctx->fifo_tail);
+    uint32_t space = CONFIG_CTSHELL_FIFO_SIZE - (head - tail);
+    if (len > space) len = (uint16_t) space;
+    if (len == 0) return 0;
+
+    uint32_t off = head & FIFO_MASK;
+    uint32_t first = CONFIG_CTSHELL_FIFO_SIZE - off;
+    if (first > len) first = len;
+    memcpy(&ctx->fifo_buf[off], data, first);
+    memcpy(&ctx->fifo_buf[0], data + first, len - first);
+    SHARED_STORE_RELEASE(&ctx->fifo_head, head + len);
+    return len;
+}
+
 void ctshell_input(ctshell_ctx_t *ctx, char byte) {
+#ifdef CONFIG_CTSHELL_USE_RPC
+    if (ctx->rpc_mode) {
+        ctshell_fifo_push(ctx, &byte, 1);
+        return;
+    }
+#endif
     if (byte == CTSHELL_KEY_CTRL_C) {
         ctx->sigint = 1;
-        if (!ctx->is_executing) {
-            uint16_t next_head = (ctx->fifo_head + 1) % CONFIG_CTSHELL_FIFO_SIZE;
-            if (next_head != ctx->fifo_tail) {
-                ctx->fifo_buf[ctx->fifo_head] = byte;
-                ctx->fifo_head = next_head;
-            }
-        }
-        return;
+        if (CTSHELL_BUSY(ctx)) return;
     }
+    ctshell_fifo_push(ctx, &byte, 1);
+}
 
-    uint16_t next_head = (ctx->fifo_head + 1) % CONFIG_CTSHELL_FIFO_SIZE;
-    if (next_head != ctx->fifo_tail) {
-        ctx->fifo_buf[ctx->fifo_head] = byte;
-        ctx->fifo_head = next_head;
+uint16_t ctshell_input_buf(ctshell_ctx_t *ctx, const char *data, uint16_t len) {
+    if (!ctx || !data) return 0;
+
+#ifdef CONFIG_CTSHELL_USE_RPC
+    // packets may contain any byte but 0x00, Ctrl+C among them
+    if (ctx->rpc_mode) return ctshell_fifo_push(ctx, data, len);
+#endif
+    const char *ctrl_c = memchr(data, CTSHELL_KEY_CTRL_C, len);
+    if (!ctrl_c) {
+        return ctshell_fifo_push(ctx, data, len);
+    }
+
+    ctx->sigint = 1;
+    if (!CTSHELL_BUSY(ctx)) {
+        return ctshell_fifo_push(ctx, data, len);
+    }
+
+    // a command is running: Ctrl+C only raises the signal and is not queued
+    uint16_t done = 0;
+    while (done < len) {
+        const char *seg = data + done;
+        uint16_t seg_len = ctrl_c ? (uint16_t) (ctrl_c - seg) : (uint16_t) (len - done);
+        uint16_t pushed = ctshell_fifo_push(ctx, seg, seg_len);
+        done += pushed;
+        if (pushed < seg_len) break;
+        if (ctrl_c) {
+            done++;
+            ctrl_c = memchr(data + done, CTSHELL_KEY_CTRL_C, len - done);
+        }
     }
+    return done;
 }
 
 void ctshell_poll(ctshell_ctx_t *ctx) {
-    while (ctx->fifo_head != ctx->fifo_tail) {
-        char byte = ctx->fifo_buf[ctx->fifo_tail];
-        ctx->fifo_tail = (ctx->fifo_tail + 1) % CONFIG_CTSHELL_FIFO_SIZE;
+    ctshell_ctx_t *prev = g_ctshell_cur;
+    g_ctshell_cur = ctx;
+
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+    if (ctx->fg && job_poll_fg(ctx)) {
+        ctshell_puts(ctx, "\r\n" CONFIG_CTSHELL_PROMPT);
+    }
+    job_poll_background(ctx);
+#endif
+
+#if defined(CONFIG_CTSHELL_USE_RPC) && CONFIG_CTSHELL_RPC_TIMEOUT > 0
+    // a terminal left in RPC mode gets its prompt back once it stops typing
+    if (rpc_timeout(ctx) == 0) rpc_leave(ctx);
+#endif
+
+    uint32_t tail = SHARED_LOAD_RELAXED(&ctx->fifo_tail);
+    uint32_t head = SHARED_LOAD_ACQUIRE(&ctx->fifo_head);
+#if defined(CONFIG_CTSHELL_USE_RPC) && CONFIG_CTSHELL_RPC_TIMEOUT > 0
+    uint32_t first = tail;
+#endif
+
+    while (tail != head) {
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+        // typeahead waits in the FIFO until the foreground job ends
+        if (ctx->fg) break;
+#endif
+        char byte = ctx->fifo_buf[tail & FIFO_MASK];
+        tail++;
+        SHARED_STORE_RELEASE(&ctx->fifo_tail, tail);
+
+        uint8_t cr_lf = ctx->quiet_lf && byte == '\n';
+        ctx->quiet_lf = 0;
+        if (cr_lf) {
+            // the LF of the CR LF that ended `quiet off`, not an Enter of its own
+        } else
+#ifdef CONFIG_CTSHELL_USE_RPC
+        if (RPC_OPEN(ctx)) {
+            rpc_input(ctx, (uint8_t) byte);
+        } else
+#endif
+        if (ctx->quiet) {
+            quiet_input(ctx, byte);
+        } else {
+            ctshell_handle_byte(ctx, byte);
+        }
+        if (tail == head) {
+            head = SHARED_LOAD_ACQUIRE(&ctx->fifo_head);
+        }
+    }
+#if defined(CONFIG_CTSHELL_USE_RPC) && CONFIG_CTSHELL_RPC_TIMEOUT > 0
+    if (tail != first && RPC_OPEN(ctx) && ctx->io.get_tick) ctx->rpc.rx_tick = ctx->io.get_tick();
+#endif
+    ctshell_flush(ctx);
+    g_ctshell_cur = prev;
+}
+
+uint32_t ctshell_next_timeout(ctshell_ctx_t *ctx) {
+    uint32_t ms = CTSHELL_WAIT_FOREVER;
+#if defined(CONFIG_CTSHELL_USE_RPC) && CONFIG_CTSHELL_RPC_TIMEOUT > 0
+    ms = rpc_timeout(ctx);
+    if (ms == 0) return 0;
+#endif
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+    if (ctx->fg && ctx->sigint) return 0;
+    for (int i = 0; i < CONFIG_CTSHELL_JOB_MAX; i++) {
+        const ctshell_job_t *job = &ctx->jobs[i];
+        if (!job->active) continue;
+        if (!job->sleeping || !ctx->io.get_tick) return 0;
+        int32_t left = (int32_t) (job->wake - ctx->io.get_tick());
+        if (left <= 0) return 0;
+        if ((uint32_t) left < ms) ms = (uint32_t) left;
+    }
+    // typeahead is ignored while a foreground job runs
+    if (ctx->fg) return ms;
+#endif
+    if (SHARED_LOAD_ACQUIRE(&ctx->fifo_head) != SHARED_LOAD_RELAXED(&ctx->fifo_tail)) return 0;
+    return ms;
+}
 
-        ctshell_handle_byte(ctx, byte);
+void ctshell_idle(ctshell_ctx_t *ctx) {
+    if (!ctx || !ctx->io.idle) return;
+    uint32_t ms = ctshell_next_timeout(ctx);
+    if (ms > 0) {
+        ctx->io.idle(ms, ctx->priv);
     }
 }
 
@@ -546,8 +2876,35 @@ void ctshell_init(ctshell_ctx_t *ctx, ctshell_io_t io, void *priv) {
     memset(ctx, 0, sizeof(ctshell_ctx_t));
     ctx->io = io;
     ctx->priv = priv;
-    g_ctshell_ctx = ctx;
+    DEFAULT_CTX_STORE(ctx);
+#if CONFIG_CTSHELL_CMD_INDEX_SIZE > 0
+    // the section size is only known after linking, so a short index is reported here
+    if (ctshell_cmd_index_build() < 0) {
+        ctshell_ctx_printf(ctx, "\r\nwarning: %u commands exceed CTSHELL_CMD_INDEX_SIZE %u, lookups scan the table",
+                           (unsigned) (CMD_END - CMD_START), (unsigned) CONFIG_CTSHELL_CMD_INDEX_SIZE);
+    }
+#endif
     ctshell_puts(ctx, "\r\n" CONFIG_CTSHELL_PROMPT);
+    ctshell_flush(ctx);
+}
+
+/* a shell that goes away stops being the fallback, another one initialized later is kept */
+void ctshell_deinit(ctshell_ctx_t *ctx) {
+    if (!ctx) return;
+    if (g_ctshell_cur == ctx) g_ctshell_cur = NULL;
+    DEFAULT_CTX_CLEAR(ctx);
+}
+
+void ctshell_set_echo(ctshell_ctx_t *ctx, int on) {
+    if (ctx) ctx->no_echo = !on;
+}
+
+void ctshell_set_quiet(ctshell_ctx_t *ctx, int on) {
+    if (!ctx) return;
+    ctx->quiet = on != 0;
+    ctx->quiet_long = 0;
+    // numbering restarts so a host can resynchronize by turning it on again
+    if (on) ctx->quiet_seq = 0;
 }
 
 void ctshell_delay(ctshell_ctx_t *ctx, uint32_t ms) {
@@ -555,9 +2912,14 @@ void ctshell_delay(ctshell_ctx_t *ctx, uint32_t ms) {
         return;
     }
 
+    ctshell_flush(ctx);
     uint32_t start_tick = ctx->io.get_tick();
+    uint32_t elapsed;
 
-    while ((ctx->io.get_tick() - start_tick) < ms) {
+    while ((elapsed = ctx->io.get_tick() - start_tick) < ms) {
+        if (ctx->io.idle) {
+            ctx->io.idle(ms - elapsed, ctx->priv);
+        }
         ctshell_check_abort(ctx);
     }
 }
@@ -668,9 +3030,123 @@ int ctshell_has(ctshell_arg_parser_t *p, const char *key) {
     return (d && d->found);
 }
 
+static void print_cmd_path(const ctshell_cmd_t *cmd) {
+    if (cmd->parent) {
+        print_cmd_path(cmd->parent);
+        ctshell_printf(" ");
+    }
+    ctshell_printf("%s", cmd->name);
+}
+
+static void print_usage(const ctshell_cmd_t *cmd) {
+    ctshell_printf("Usage: ");
+    print_cmd_path(cmd);
+    int verbs = 0;
+    for (int i = 0; i < cmd->nargs; i++) {
+        if (cmd->args[i].type != CTSHELL_ARG_VERB) continue;
+        ctshell_printf(verbs++ ? "|%s" : " [%s", cmd->args[i].flag);
+    }
+    if (verbs) ctshell_printf("]");
+    for (int i = 0; i < cmd->nargs; i++) {
+        const ctshell_arg_spec_t *sp = &cmd->args[i];
+        if (sp->type == CTSHELL_ARG_VERB) continue;
+        if (sp->type == CTSHELL_ARG_BOOL) {
+            ctshell_printf(" [%s]", sp->flag);
+        } else {
+            ctshell_printf(" [%s %s]", sp->flag, sp->value ? sp->value : "value");
+        }
+    }
+    ctshell_printf("\r\n");
+}
+
+void ctshell_usage(void) {
+    ctshell_ctx_t *ctx = ctshell_current_ctx();
+    if (ctx && ctx->cmd) print_usage(ctx->cmd);
+}
+
+/* a leading '-' followed by a digit or '.' is a negative number, not a flag */
+static inline int arg_is_flag(const char *arg) {
+    return arg[0] == '-' && arg[1] && !isdigit((int) arg[1]) && arg[1] != '.';
+}
+
+static int arg_bad_value(const ctshell_arg_spec_t *sp, const char *val) {
+    char *end = NULL;
+    if (sp->type == CTSHELL_ARG_INT) {
+        strtol(val, &end, 0);
+    }
+#ifdef CONFIG_CTSHELL_USE_DOUBLE
+    else if (sp->type == CTSHELL_ARG_DOUBLE) {
+        strtod(val, &end);
+    }
+#endif
+    else {
+        return 0;
+    }
+    return end == val || *end != '\0';
+}
+
+/*
+ * Matches argv against the schema of the running command in one pass.
+ * Arguments that are neither flags nor verbs are left to the command.
+ */
+int ctshell_parse(ctshell_args_t *a, int argc, char *argv[]) {
+    ctshell_ctx_t *ctx = ctshell_current_ctx();
+    const ctshell_cmd_t *cmd = ctx ? ctx->cmd : NULL;
+    memset(a->pos, 0, sizeof(a->pos));
+    a->argv = argv;
+    if (!cmd) return -1;
+
+    for (int k = 1; k < argc; k++) {
+        const ctshell_arg_spec_t *sp;
+        if (k == 1 && (sp = find_spec(cmd, argv[k], 1)) != NULL) {
+            a->pos[sp - cmd->args] = (uint8_t) k;
+            continue;
+        }
+        if (!arg_is_flag(argv[k])) continue;
+        sp = find_spec(cmd, argv[k], 0);
+        if (!sp) {
+            ctshell_printf("%s: unknown option '%s'\r\n", cmd->name, argv[k]);
+            print_usage(cmd);
+            return -1;
+        }
+        if (sp->type != CTSHELL_ARG_BOOL) {
+            if (k + 1 >= argc) {
+                ctshell_printf("%s: option '%s' needs a value\r\n", cmd->name, argv[k]);
+                print_usage(cmd);
+                return -1;
+            }
+            if (arg_bad_value(sp, argv[++k])) {
+                ctshell_printf("%s: invalid value '%s' for '%s'\r\n", cmd->name, argv[k], sp->flag);
+                return -1;
+            }
+        }
+        a->pos[sp - cmd->args] = (uint8_t) k;
+    }
+    return 0;
+}
+
+int ctshell_arg_has(const ctshell_args_t *a, int idx) {
+    return a->pos[idx] != 0;
+}
+
+int ctshell_arg_int(const ctshell_args_t *a, int idx, int def) {
+    return a->pos[idx] ? (int) strtol(a->argv[a->pos[idx]], NULL, 0) : def;
+}
+
+const char *ctshell_arg_str(const ctshell_args_t *a, int idx, const char *def) {
+    return a->pos[idx] ? a->argv[a->pos[idx]] : def;
+}
+
+#ifdef CONFIG_CTSHELL_USE_DOUBLE
+double ctshell_arg_double(const ctshell_args_t *a, int idx, double def) {
+    return a->pos[idx] ? strtod(a->argv[a->pos[idx]], NULL) : def;
+}
+#endif
+
 #ifdef CONFIG_CTSHELL_USE_FS
 #define CHECK_FS_READY() \
-    if (!g_ctshell_ctx || !g_ctshell_ctx->fs_drv) { \
+    ctshell_ctx_t *ctx = ctshell_current_ctx(); \
+    if (!ctx || !ctx->fs_drv) { \
         ctshell_error("Filesystem not initialized.\r\n"); \
         return -1; \
     }
@@ -741,21 +3217,22 @@ static int cmd_help(int argc, char *argv[]) {
             ctshell_printf("\r\n%s: command not found", argv[1]);
             return 0;
         }
+        if (!ctshell_is_menu(target_parent)) {
+            ctshell_printf("%s: %s\r\n", target_parent->name, target_parent->desc);
+            if (target_parent->nargs) print_usage(target_parent);
+            return 0;
+        }
     }
     ctshell_printf("Available commands:\r\n");
-    const ctshell_cmd_t *cmd = CMD_START;
-    const ctshell_cmd_t *end = CMD_END;
-    for (; cmd < end; cmd++) {
+    ctshell_cmd_iter_t it;
+    const ctshell_cmd_t *cmd;
+    ctshell_cmd_iter_init(&it, target_parent);
+    while ((cmd = ctshell_cmd_iter_next(&it)) != NULL) {
         if (cmd->attrs & CTSHELL_ATTR_HIDDEN) continue;
-        if (cmd->parent == target_parent) {
-            char name_buf[CONFIG_CTSHELL_CMD_NAME_MAX_LEN];
-            if (ctshell_is_menu(cmd)) {
-                snprintf(name_buf, sizeof(name_buf), "%s/", cmd->name);
-            } else {
-                snprintf(name_buf, sizeof(name_buf), "%s", cmd->name);
-            }
-            ctshell_printf("  %-15s : %s\r\n", name_buf, cmd->desc);
-        }
+        int name_len = strlen(cmd->name);
+        int is_menu = ctshell_is_menu(cmd);
+        ctshell_printf("  %s%-*s : %s\r\n", cmd->name, name_len < 15 ? 15 - name_len : 0,
+                       is_menu ? "/" : "", cmd->desc);
     }
     return 0;
 }
@@ -773,116 +3250,354 @@ static int cmd_clear(int argc, char *argv[]) {
 CTSHELL_EXPORT_CMD(clear, cmd_clear, "Clear screen", CTSHELL_ATTR_NONE);
 
 static int cmd_echo(int argc, char *argv[]) {
-#ifndef CONFIG_CTSHELL_USE_FS
     for (int i = 1; i < argc; i++) {
-        ctshell_printf("%s ", argv[i]);
+        ctshell_printf("%s%s", argv[i], (i < argc - 1) ? " " : "");
     }
     ctshell_printf("\r\n");
     return 0;
-#else
-    int redirect_idx = -1;
-    int append_mode = 0;
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], ">") == 0) {
-            redirect_idx = i;
-            append_mode = 0;
-            break;
-        } else if (strcmp(argv[i], ">>") == 0) {
-            redirect_idx = i;
-            append_mode = 1;
-            break;
+}
+CTSHELL_EXPORT_CMD(echo, cmd_echo, "Echo args to stdout", CTSHELL_ATTR_NONE);
+
+static int cmd_set(int argc, char *argv[]) {
+    ctshell_ctx_t *ctx = ctshell_current_ctx();
+    if (!ctx) return -1;
+    if (argc == 1) {
+        for (int off = 0; off < ctx->var_used; off += var_size(&ctx->var_arena[off])) {
+            char *v = &ctx->var_arena[off];
+            ctshell_printf("%s=%s\r\n", var_name(v), var_value(v));
         }
+        return 0;
     }
-    if (redirect_idx == -1) {
-        for (int i = 1; i < argc; i++) {
-            ctshell_printf("%s%s", argv[i], (i < argc - 1) ? " " : "");
+    if (argc == 3) {
+        if (set_var(ctx, argv[1], argv[2]) == 0) {
+            ctshell_printf("Variable %s set to %s\r\n", argv[1], argv[2]);
+        } else {
+            ctshell_error("Variable list full\r\n");
         }
-        ctshell_printf("\r\n");
         return 0;
     }
-    CHECK_FS_READY();
-    if (redirect_idx + 1 >= argc) {
-        ctshell_printf("echo: syntax error near unexpected token 'newline'\r\n");
-        return 0;
+    ctshell_printf("Usage: set [NAME] [VALUE] or set (list all)\r\n");
+    return 0;
+}
+CTSHELL_EXPORT_CMD(set, cmd_set, "Set or list variables", CTSHELL_ATTR_NONE);
+
+enum { QUIET_OPT_ON, QUIET_OPT_OFF };
+
+static const ctshell_arg_spec_t quiet_args[] = {
+    [QUIET_OPT_ON]  = CTSHELL_OPT_VERB("on"),
+    [QUIET_OPT_OFF] = CTSHELL_OPT_VERB("off"),
+};
+
+static int cmd_quiet(int argc, char *argv[]) {
+    ctshell_ctx_t *ctx = ctshell_current_ctx();
+    if (!ctx) return -1;
+
+    ctshell_args_t a;
+    if (ctshell_parse(&a, argc, argv) != 0) return -1;
+
+    if (ctshell_arg_has(&a, QUIET_OPT_ON)) {
+        ctshell_set_quiet(ctx, 1);
+    } else if (ctshell_arg_has(&a, QUIET_OPT_OFF)) {
+        ctshell_set_quiet(ctx, 0);
+    } else {
+        ctshell_printf("%s\r\n", ctx->quiet ? "on" : "off");
     }
-    char path[CONFIG_CTSHELL_FS_PATH_MAX];
-    const char *target = argv[redirect_idx + 1];
-    ctshell_fs_resolve_path(g_ctshell_ctx->cwd, target, path, sizeof(path));
-    int open_flag = append_mode ? CTSHELL_O_APPEND : CTSHELL_O_TRUNC;
-    int fd = g_ctshell_ctx->fs_drv->open(path, open_flag);
-    if (fd < 0) {
-        ctshell_printf("echo: cannot open file '%s'\r\n", path);
+    return 0;
+}
+CTSHELL_EXPORT_CMD_ARGS(quiet, cmd_quiet, "Switch the non-interactive line mode", quiet_args, CTSHELL_ATTR_NONE);
+
+#ifdef CONFIG_CTSHELL_USE_STATS
+static const char *const stats_sort_keys[] = {"calls", "total", "avg", "max", "aborts", "out"};
+
+static uint64_t stats_key(const ctshell_cmd_stats_t *st, int key) {
+    switch (key) {
+        case 0: return st->count;
+        case 1: return st->total;
+        case 2: return st->total / st->count;
+        case 3: return st->max;
+        case 4: return st->aborts;
+        case 5: return st->out_bytes;
+        default: return 0;
+    }
+}
+
+/*
+ * Next row in descending key order, ties in section order. Rows are picked
+ * by repeated scans so listing needs no scratch space.
+ */
+static int stats_next(const ctshell_ctx_t *ctx, int n, int key, int prev) {
+    uint64_t prev_val = prev >= 0 ? stats_key(&ctx->stats[prev], key) : 0;
+    int best = -1;
+    uint64_t best_val = 0;
+    for (int i = 0; i < n; i++) {
+        const ctshell_cmd_stats_t *st = &ctx->stats[i];
+        if (st->count == 0) continue;
+        uint64_t v = stats_key(st, key);
+        if (prev >= 0 && (v > prev_val || (v == prev_val && i <= prev))) continue;
+        if (best < 0 || v > best_val) {
+            best = i;
+            best_val = v;
+        }
+    }
+    return best;
+}
+
+static void stats_print_row(const ctshell_cmd_t *cmd, const ctshell_cmd_stats_t *st) {
+    const char *parent = cmd->parent ? cmd->parent->name : "";
+    int width = 16 - (int) strlen(parent) - (cmd->parent ? 1 : 0);
+    ctshell_printf("  %s%s%-*s %7u %11llu %9u %9u %9u %6u %9u\r\n", parent, cmd->parent ? " " : "",
+                   width > 0 ? width : 0, cmd->name, st->count, (unsigned long long) st->total,
+                   (unsigned) (st->total / st->count), st->min, st->max, st->aborts, st->out_bytes);
+}
+
+enum { STATS_OPT_RESET, STATS_OPT_SORT };
+
+static const ctshell_arg_spec_t stats_args[] = {
+    [STATS_OPT_RESET] = CTSHELL_OPT_BOOL("-r"),
+    [STATS_OPT_SORT]  = CTSHELL_OPT_STR("-s", "calls|total|avg|max|aborts|out"),
+};
+
+static int cmd_stats(int argc, char *argv[]) {
+    ctshell_ctx_t *ctx = ctshell_current_ctx();
+    if (!ctx) return -1;
+
+    ctshell_args_t a;
+    if (ctshell_parse(&a, argc, argv) != 0) return -1;
+
+    if (ctshell_arg_has(&a, STATS_OPT_RESET)) {
+        memset(ctx->stats, 0, sizeof(ctx->stats));
+        ctx->stats_dropped = 0;
+        ctshell_printf("Statistics cleared\r\n");
         return 0;
     }
-    if (append_mode && g_ctshell_ctx->fs_drv->lseek) {
-        g_ctshell_ctx->fs_drv->lseek(fd, 0, SEEK_END);
+
+    int key = -1;
+    const char *sort = ctshell_arg_str(&a, STATS_OPT_SORT, NULL);
+    if (sort) {
+        for (int i = 0; i < (int) (sizeof(stats_sort_keys) / sizeof(stats_sort_keys[0])); i++) {
+            if (strcmp(sort, stats_sort_keys[i]) == 0) key = i;
+        }
+        if (key < 0) {
+            ctshell_usage();
+            return 0;
+        }
     }
-    for (int i = 1; i < redirect_idx; i++) {
-        const char *str = argv[i];
-        g_ctshell_ctx->fs_drv->write(fd, str, strlen(str));
-        if (i < redirect_idx - 1) {
-            g_ctshell_ctx->fs_drv->write(fd, " ", 1);
+
+    int n = (int) (CMD_END - CMD_START);
+    if (n > CONFIG_CTSHELL_STATS_SIZE) n = CONFIG_CTSHELL_STATS_SIZE;
+
+    ctshell_printf("  %-16s %7s %11s %9s %9s %9s %6s %9s\r\n",
+                   "command", "calls", "total us", "avg us", "min us", "max us", "aborts", "out");
+    if (key < 0) {
+        for (int i = 0; i < n; i++) {
+            if (ctx->stats[i].count) stats_print_row(&CMD_START[i], &ctx->stats[i]);
+        }
+    } else {
+        for (int i = stats_next(ctx, n, key, -1); i >= 0; i = stats_next(ctx, n, key, i)) {
+            stats_print_row(&CMD_START[i], &ctx->stats[i]);
         }
     }
-    g_ctshell_ctx->fs_drv->write(fd, "\r\n", 2);
-    g_ctshell_ctx->fs_drv->close(fd);
+    if (ctx->stats_dropped) {
+        ctshell_printf("  runs not recorded: %u, their commands are past CTSHELL_STATS_SIZE %u\r\n",
+                       (unsigned) ctx->stats_dropped, (unsigned) CONFIG_CTSHELL_STATS_SIZE);
+    }
     return 0;
+}
+CTSHELL_EXPORT_CMD_ARGS(stats, cmd_stats, "Show command statistics", stats_args, CTSHELL_ATTR_NONE);
 #endif
+
+/* 64-bit, 2^32 cycles of a slow counter are far more than 2^32 ns */
+static uint64_t time_cycles_to_ns(const ctshell_ctx_t *ctx, uint32_t cycles) {
+    return (uint64_t) cycles * 1000000000ull / ctx->io.cycles_hz;
 }
-CTSHELL_EXPORT_CMD(echo, cmd_echo, "Echo args to stdout or file", CTSHELL_ATTR_NONE);
 
-static int cmd_set(int argc, char *argv[]) {
-    if (!g_ctshell_ctx) return -1;
-    if (argc == 1) {
-        for (int i = 0; i < CONFIG_CTSHELL_VAR_MAX_COUNT; i++) {
-            if (g_ctshell_ctx->vars[i].used) {
-                ctshell_printf("%s=%s\r\n", g_ctshell_ctx->vars[i].name, g_ctshell_ctx->vars[i].value);
-            }
-        }
+static void time_print_us(const char *label, uint64_t ns) {
+    ctshell_printf("%s%llu.%03u us", label, (unsigned long long) (ns / 1000), (unsigned) (ns % 1000));
+}
+
+static int cmd_time(int argc, char *argv[]) {
+    ctshell_ctx_t *ctx = ctshell_current_ctx();
+    if (!ctx) return -1;
+    if (argc < 2) {
+        ctshell_printf("Usage: time <command> [args...]\r\n");
         return 0;
     }
-    if (argc == 3) {
-        if (set_var(g_ctshell_ctx, argv[1], argv[2]) == 0) {
-            ctshell_printf("Variable %s set to %s\r\n", argv[1], argv[2]);
+
+    uint32_t (*cycles)(void) = ctx->io.cycles_hz ? ctx->io.get_cycles : NULL;
+    uint32_t read_cost = UINT32_MAX;
+    for (int i = 0; cycles && i < 4; i++) {
+        // back-to-back reads, the cheapest one is the cost of the counter itself
+        uint32_t t = cycles();
+        t = cycles() - t;
+        if (t < read_cost) read_cost = t;
+    }
+
+    uint32_t tick_start = ctx->io.get_tick ? ctx->io.get_tick() : 0;
+    uint32_t c0 = cycles ? cycles() : 0;
+    int arg_idx;
+    const ctshell_cmd_t *cmd = ctshell_resolve(argc - 1, &argv[1], &arg_idx);
+    uint32_t c1 = cycles ? cycles() : 0;
+    if (!cmd || !cmd->func) {
+        ctshell_dispatch(ctx, argc - 1, &argv[1], 0);
+        return 0;
+    }
+    ctshell_run(ctx, cmd, argc - 1 - arg_idx, &argv[1 + arg_idx]);
+    uint32_t c2 = cycles ? cycles() : 0;
+    uint32_t ticks = ctx->io.get_tick ? ctx->io.get_tick() - tick_start : 0;
+
+    // past half a counter period the cycle count may have wrapped, fall back to ticks
+    uint64_t wrap_ms = ((uint64_t) 1 << 32) * 1000 / (ctx->io.cycles_hz ? ctx->io.cycles_hz : 1);
+    if (!cycles || ticks >= wrap_ms / 2) {
+        if (ctx->io.get_tick) {
+            ctshell_printf("\r\nreal %u ms\r\n", (unsigned) ticks);
         } else {
-            ctshell_error("Variable list full\r\n");
+            ctshell_printf("\r\ntime: no timebase\r\n");
         }
         return 0;
     }
-    ctshell_printf("Usage: set [NAME] [VALUE] or set (list all)\r\n");
+
+    // c0..c2 spans two counter reads that belong to neither part
+    uint32_t lookup = c1 - c0 > read_cost ? c1 - c0 - read_cost : 0;
+    uint32_t run = c2 - c1 > read_cost ? c2 - c1 - read_cost : 0;
+    time_print_us("\r\nreal ", time_cycles_to_ns(ctx, lookup + run));
+    time_print_us(", command ", time_cycles_to_ns(ctx, run));
+    time_print_us(", shell ", time_cycles_to_ns(ctx, lookup));
+    ctshell_printf("\r\n");
     return 0;
 }
-CTSHELL_EXPORT_CMD(set, cmd_set, "Set or list variables", CTSHELL_ATTR_NONE);
+CTSHELL_EXPORT_CMD(time, cmd_time, "Run a command and report its execution time", CTSHELL_ATTR_NONE);
 
-static int ctshell_exec_line(ctshell_ctx_t *ctx, const char *line) {
-    if (!ctx || !line) {
-        return -1;
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+static int cmd_jobs(int argc, char *argv[]) {
+    CTSHELL_UNUSED_PARAM(argc);
+    CTSHELL_UNUSED_PARAM(argv);
+    ctshell_ctx_t *ctx = ctshell_current_ctx();
+    if (!ctx) return -1;
+
+    for (int i = 0; i < CONFIG_CTSHELL_JOB_MAX; i++) {
+        const ctshell_job_t *job = &ctx->jobs[i];
+        if (job_listed(ctx, job)) {
+            job_report(ctx, job, job->sleeping ? "Sleeping" : "Running");
+        }
     }
+    return 0;
+}
+CTSHELL_EXPORT_CMD(jobs, cmd_jobs, "List background jobs", CTSHELL_ATTR_NONE);
 
-    char line_buf_backup[CONFIG_CTSHELL_LINE_BUF_SIZE];
-    memcpy(line_buf_backup, ctx->line_buf, sizeof(line_buf_backup));
-    int line_len_backup = ctx->line_len;
-    int cur_pos_backup = ctx->cur_pos;
+static int cmd_fg(int argc, char *argv[]) {
+    ctshell_ctx_t *ctx = ctshell_current_ctx();
+    if (!ctx) return -1;
 
-    strncpy(ctx->line_buf, line, CONFIG_CTSHELL_LINE_BUF_SIZE - 1);
-    ctx->line_buf[CONFIG_CTSHELL_LINE_BUF_SIZE - 1] = '\0';
-    ctx->line_len = strlen(ctx->line_buf);
-    ctx->cur_pos = ctx->line_len;
+    ctshell_job_t *job = job_lookup(ctx, argc, argv);
+    if (!job) return -1;
+    for (int i = 0; i < job->argc; i++) {
+        ctshell_printf(i ? " %s" : "%s", job->argv[i]);
+    }
+    ctshell_puts(ctx, "\r\n");
+    // resumed from ctshell_poll once this command returns, Ctrl+C now cancels it
+    ctx->fg = job;
+    return 0;
+}
+CTSHELL_EXPORT_CMD(fg, cmd_fg, "Bring a background job to the foreground", CTSHELL_ATTR_NONE);
 
-    ctshell_exec(ctx, 0);
+static int cmd_kill(int argc, char *argv[]) {
+    ctshell_ctx_t *ctx = ctshell_current_ctx();
+    if (!ctx) return -1;
 
-    memcpy(ctx->line_buf, line_buf_backup, sizeof(line_buf_backup));
-    ctx->line_len = line_len_backup;
-    ctx->cur_pos = cur_pos_backup;
+    ctshell_job_t *job = job_lookup(ctx, argc, argv);
+    if (!job) return -1;
+    job_cancel(ctx, job);
+    job_report(ctx, job, "Killed");
     return 0;
 }
+CTSHELL_EXPORT_CMD(kill, cmd_kill, "Cancel a background job", CTSHELL_ATTR_NONE);
+#endif
+
+#ifdef CONFIG_CTSHELL_USE_PIPE
+/* `k` bytes of `pattern` are matched so far, returns the count after one more byte */
+static int grep_step(const char *pattern, int k, char c) {
+    for (;;) {
+        if (pattern[k] == c) return k + 1;
+        if (k == 0) return 0;
+        // fall back to the longest prefix that is also a suffix of the matched part
+        int b = k - 1;
+        while (b > 0 && memcmp(pattern, &pattern[k - b], b) != 0) b--;
+        k = b;
+    }
+}
+
+typedef struct {
+    uint16_t matched; // pattern bytes matched at the end of the text read so far
+    uint16_t held;    // bytes of the current line kept in job->arg_buf
+    uint8_t found;
+    uint8_t spill;    // the line outgrew arg_buf, the rest follows the decision taken then
+    uint8_t show;
+} grep_state_t;
+
+static void grep_scan(grep_state_t *s, const char *pattern, int len, const char *text, int n) {
+    for (int i = 0; i < n && !s->found; i++) {
+        s->matched = (uint16_t) grep_step(pattern, s->matched, text[i]);
+        if (s->matched == len) s->found = 1;
+    }
+}
+
+static int cmd_grep(ctshell_job_t *job) {
+    grep_state_t *s = CTSHELL_JOB_STATE(job, grep_state_t);
+    int invert = job->argc == 3 && strcmp(job->argv[1], "-v") == 0;
+    const char *pattern = job->argv[job->argc - 1];
+    // a pipeline stage's arguments stay in the line buffer, so arg_buf holds the pending line
+    char *hold = job->arg_buf;
+    const char *line;
+    int n;
+
+    CTSHELL_ASYNC_BEGIN(job);
+    if (job->argc != 2 && !invert) {
+        ctshell_printf("Usage: <command> | grep [-v] <pattern>\r\n");
+        return -1;
+    }
+    for (;;) {
+        CTSHELL_ASYNC_WAIT_UNTIL(job, (n = ctshell_job_readline(job, &line)) != 0);
+        if (n == CTSHELL_EOF) break;
+        if (s->held == 0 && !s->spill) s->found = pattern[0] == '\0';
+        grep_scan(s, pattern, (int) strlen(pattern), line, n);
+        int eol = line[n - 1] == '\n';
+
+        if (s->spill) {
+            if (s->show) ctshell_write(job->ctx, line, n);
+        } else if (eol && s->held == 0) {
+            if (s->found != invert) ctshell_write(job->ctx, line, n);
+        } else if (s->held + n <= (int) sizeof(job->arg_buf)) {
+            memcpy(&hold[s->held], line, n);
+            s->held += n;
+            if (eol && s->found != invert) ctshell_write(job->ctx, hold, s->held);
+        } else {
+            s->spill = 1;
+            s->show = s->found != invert;
+            if (s->show) {
+                ctshell_write(job->ctx, hold, s->held);
+                ctshell_write(job->ctx, line, n);
+            }
+        }
+        if (eol) {
+            s->held = 0;
+            s->matched = 0;
+            s->spill = 0;
+        }
+    }
+    // the input ended inside a line
+    if (s->held > 0 && s->found != invert) ctshell_write(job->ctx, hold, s->held);
+    CTSHELL_ASYNC_END(job);
+}
+CTSHELL_EXPORT_ASYNC_CMD(grep, cmd_grep, "Print the input lines containing a pattern", CTSHELL_ATTR_NONE);
+#endif
 
 static int cmd_unset(int argc, char *argv[]) {
-    if (!g_ctshell_ctx || argc != 2) {
+    ctshell_ctx_t *ctx = ctshell_current_ctx();
+    if (!ctx || argc != 2) {
         ctshell_printf("Usage: unset <NAME>\r\n");
         return 0;
     }
-    unset_var(g_ctshell_ctx, argv[1]);
+    unset_var(ctx, argv[1]);
     return 0;
 }
 CTSHELL_EXPORT_CMD(unset, cmd_unset, "Unset a variable", CTSHELL_ATTR_NONE);
@@ -892,9 +3607,9 @@ static int cmd_ls(int argc, char *argv[]) {
     CHECK_FS_READY();
     char path[CONFIG_CTSHELL_FS_PATH_MAX];
     const char *target = (argc > 1) ? argv[1] : ".";
-    ctshell_fs_resolve_path(g_ctshell_ctx->cwd, target, path, sizeof(path));
+    ctshell_fs_resolve_path(ctx->cwd, target, path, sizeof(path));
     void *dir;
-    if (g_ctshell_ctx->fs_drv->opendir(path, &dir) != 0) {
+    if (ctx->fs_drv->opendir(path, &dir) != 0) {
         ctshell_printf("ls: cannot access '%s': No such directory\r\n", path);
         return 0;
     }
@@ -902,13 +3617,13 @@ static int cmd_ls(int argc, char *argv[]) {
     ctshell_printf("Type  Size        Name\r\n");
     ctshell_printf("----  ----------  ----\r\n");
     ctshell_dirent_t entry;
-    while (g_ctshell_ctx->fs_drv->readdir(dir, &entry) == 0) {
+    while (ctx->fs_drv->readdir(dir, &entry) == 0) {
         ctshell_printf("%-4s  %10u  %s\r\n",
                        (entry.type == CTSHELL_FS_TYPE_DIR) ? "DIR" : "FILE",
                        entry.size,
                        entry.name);
     }
-    g_ctshell_ctx->fs_drv->closedir(dir);
+    ctx->fs_drv->closedir(dir);
     return 0;
 }
 CTSHELL_EXPORT_CMD(ls, cmd_ls, "List directory content", CTSHELL_ATTR_NONE);
@@ -921,11 +3636,11 @@ static int cmd_cd(int argc, char *argv[]) {
     }
     const char *target = (argc == 2) ? argv[1] : "/";
     char path[CONFIG_CTSHELL_FS_PATH_MAX];
-    ctshell_fs_resolve_path(g_ctshell_ctx->cwd, target, path, sizeof(path));
+    ctshell_fs_resolve_path(ctx->cwd, target, path, sizeof(path));
     ctshell_dirent_t info;
-    if (g_ctshell_ctx->fs_drv->stat(path, &info) == 0) {
+    if (ctx->fs_drv->stat(path, &info) == 0) {
         if (info.type == CTSHELL_FS_TYPE_DIR) {
-            strncpy(g_ctshell_ctx->cwd, path, CONFIG_CTSHELL_FS_PATH_MAX - 1);
+            strncpy(ctx->cwd, path, CONFIG_CTSHELL_FS_PATH_MAX - 1);
         } else {
             ctshell_printf("cd: '%s': Not a directory\r\n", path);
         }
@@ -938,7 +3653,7 @@ CTSHELL_EXPORT_CMD(cd, cmd_cd, "Change current directory", CTSHELL_ATTR_NONE);
 
 static int cmd_pwd(int argc, char *argv[]) {
     CHECK_FS_READY();
-    ctshell_printf("%s\r\n", g_ctshell_ctx->cwd);
+    ctshell_printf("%s\r\n", ctx->cwd);
     return 0;
 }
 CTSHELL_EXPORT_CMD(pwd, cmd_pwd, "Print working directory", CTSHELL_ATTR_NONE);
@@ -950,20 +3665,20 @@ static int cmd_cat(int argc, char *argv[]) {
         return 0;
     }
     char path[CONFIG_CTSHELL_FS_PATH_MAX];
-    ctshell_fs_resolve_path(g_ctshell_ctx->cwd, argv[1], path, sizeof(path));
-    int fd = g_ctshell_ctx->fs_drv->open(path, 0);
+    ctshell_fs_resolve_path(ctx->cwd, argv[1], path, sizeof(path));
+    int fd = ctx->fs_drv->open(path, 0);
     if (fd < 0) {
         ctshell_printf("cat: '%s': Cannot open file\r\n", path);
         return 0;
     }
     char buf[128];
     int bytes;
-    while ((bytes = g_ctshell_ctx->fs_drv->read(fd, buf, sizeof(buf) - 1)) > 0) {
+    while ((bytes = ctx->fs_drv->read(fd, buf, sizeof(buf) - 1)) > 0) {
         buf[bytes] = '\0';
         ctshell_printf("%s", buf);
     }
     ctshell_printf("\r\n");
-    g_ctshell_ctx->fs_drv->close(fd);
+    ctx->fs_drv->close(fd);
     return 0;
 }
 CTSHELL_EXPORT_CMD(cat, cmd_cat, "Concatenate and print files", CTSHELL_ATTR_NONE);
@@ -975,9 +3690,9 @@ static int cmd_mkdir(int argc, char *argv[]) {
         return 0;
     }
     char path[CONFIG_CTSHELL_FS_PATH_MAX];
-    ctshell_fs_resolve_path(g_ctshell_ctx->cwd, argv[1], path, sizeof(path));
+    ctshell_fs_resolve_path(ctx->cwd, argv[1], path, sizeof(path));
 
-    if (g_ctshell_ctx->fs_drv->mkdir(path) != 0) {
+    if (ctx->fs_drv->mkdir(path) != 0) {
         ctshell_printf("mkdir: cannot create directory '%s'\r\n", path);
     }
     return 0;
@@ -991,9 +3706,9 @@ static int cmd_rm(int argc, char *argv[]) {
         return 0;
     }
     char path[CONFIG_CTSHELL_FS_PATH_MAX];
-    ctshell_fs_resolve_path(g_ctshell_ctx->cwd, argv[1], path, sizeof(path));
+    ctshell_fs_resolve_path(ctx->cwd, argv[1], path, sizeof(path));
 
-    if (g_ctshell_ctx->fs_drv->unlink(path) != 0) {
+    if (ctx->fs_drv->unlink(path) != 0) {
         ctshell_printf("rm: cannot remove '%s'\r\n", path);
     }
     return 0;
@@ -1007,11 +3722,11 @@ static int cmd_touch(int argc, char *argv[]) {
         return 0;
     }
     char path[CONFIG_CTSHELL_FS_PATH_MAX];
-    ctshell_fs_resolve_path(g_ctshell_ctx->cwd, argv[1], path, sizeof(path));
+    ctshell_fs_resolve_path(ctx->cwd, argv[1], path, sizeof(path));
 
-    int fd = g_ctshell_ctx->fs_drv->open(path, 1);
+    int fd = ctx->fs_drv->open(path, 1);
     if (fd >= 0) {
-        g_ctshell_ctx->fs_drv->close(fd);
+        ctx->fs_drv->close(fd);
     } else {
         ctshell_printf("touch: cannot create '%s'\r\n", path);
     }
@@ -1027,9 +3742,9 @@ static int cmd_sh(int argc, char *argv[]) {
     }
 
     char path[CONFIG_CTSHELL_FS_PATH_MAX];
-    ctshell_fs_resolve_path(g_ctshell_ctx->cwd, argv[1], path, sizeof(path));
+    ctshell_fs_resolve_path(ctx->cwd, argv[1], path, sizeof(path));
 
-    int fd = g_ctshell_ctx->fs_drv->open(path, 0);
+    int fd = ctx->fs_drv->open(path, 0);
     if (fd < 0) {
         ctshell_printf("sh: cannot open '%s'\r\n", path);
         return 0;
@@ -1040,8 +3755,8 @@ static int cmd_sh(int argc, char *argv[]) {
     char ch;
     int bytes;
 
-    while ((bytes = g_ctshell_ctx->fs_drv->read(fd, &ch, 1)) == 1) {
-        ctshell_check_abort(g_ctshell_ctx);
+    while ((bytes = ctx->fs_drv->read(fd, &ch, 1)) == 1) {
+        ctshell_check_abort(ctx);
 
         if (ch == '\r') {
             continue;
@@ -1049,7 +3764,7 @@ static int cmd_sh(int argc, char *argv[]) {
         if (ch == '\n') {
             line[line_len] = '\0';
             if (line_len > 0 && line[0] != '#') {
-                ctshell_exec_line(g_ctshell_ctx, line);
+                ctshell_exec(ctx, line);
             }
             line_len = 0;
             continue;
@@ -1059,7 +3774,7 @@ static int cmd_sh(int argc, char *argv[]) {
             line[line_len++] = ch;
         } else {
             ctshell_printf("sh: line too long in '%s'\r\n", path);
-            g_ctshell_ctx->fs_drv->close(fd);
+            ctx->fs_drv->close(fd);
             return 0;
         }
     }
@@ -1067,11 +3782,11 @@ static int cmd_sh(int argc, char *argv[]) {
     if (line_len > 0) {
         line[line_len] = '\0';
         if (line[0] != '#') {
-            ctshell_exec_line(g_ctshell_ctx, line);
+            ctshell_exec(ctx, line);
         }
     }
 
-    g_ctshell_ctx->fs_drv->close(fd);
+    ctx->fs_drv->close(fd);
     return 0;
 }
 CTSHELL_EXPORT_CMD(sh, cmd_sh, "Run commands from a shell script", CTSHELL_ATTR_NONE);
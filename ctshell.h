@@ -15,6 +15,15 @@ extern "C" {
 #include <setjmp.h>
 #include "ctshell_config.h"
 
+#if defined(__GNUC__) || defined(__clang__) || defined(__CC_ARM)
+#define CTSHELL_SECTION(x) __attribute__((section(x)))
+#define CTSHELL_USED       __attribute__((used))
+#define CTSHELL_ALIGN      __attribute__((aligned(sizeof(void*))))
+#define CTSHELL_CACHE_ALIGNED __attribute__((aligned(CONFIG_CTSHELL_CACHE_LINE_SIZE)))
+#else
+#error "Current compiler is not supported yet."
+#endif
+
 #define ctshell_error(fmt, ...)   ctshell_printf("Error: " fmt "\r\n", ##__VA_ARGS__)
 #define CTSHELL_UNUSED_PARAM(x) ((void)(x))
 
@@ -25,16 +34,45 @@ typedef struct {
     void (*write)(const char *str, uint16_t len, void *priv);
 
     uint32_t (*get_tick)(void);
+
+    /* optional, called once buffered output has been handed to write() */
+    void (*flush)(void *priv);
+
+    /* optional, free-running high resolution counter for `time`, may wrap at 32 bits */
+    uint32_t (*get_cycles)(void);
+    uint32_t cycles_hz; // get_cycles rate, required along with it
+
+    /*
+     * optional, sleep until input arrives or `ms` have passed, whichever is
+     * first; ms is CTSHELL_WAIT_FOREVER when only input can wake the shell
+     */
+    void (*idle)(uint32_t ms, void *priv);
 } ctshell_io_t;
 
+#define CTSHELL_WAIT_FOREVER UINT32_MAX
+
+/* variable index slots, kept at most half full so probes stay short */
+#define CTSHELL_VAR_INDEX_SIZE (2 * CONFIG_CTSHELL_VAR_MAX_COUNT)
+
+#ifdef CONFIG_CTSHELL_USE_STATS
 /**
- * @brief Shell environment variable.
+ * @brief Execution statistics of one command, times in microseconds.
  */
 typedef struct {
-    char name[CONFIG_CTSHELL_VAR_NAME_LEN];
-    char value[CONFIG_CTSHELL_VAR_VAL_LEN];
-    int used;
-} ctshell_var_t;
+    uint32_t count;
+    uint32_t aborts;
+    uint64_t total;
+    uint32_t min;
+    uint32_t max;
+    uint32_t out_bytes;
+} ctshell_cmd_stats_t;
+
+/* when a command started, io.get_cycles is exact until it may have wrapped */
+typedef struct {
+    uint32_t tick;
+    uint32_t cycles;
+} ctshell_stats_mark_t;
+#endif
 
 // picked from https://github.com/ravachol/kew/blob/main/src/ui/termbox2_input.h
 /* ASCII key constants */
@@ -95,21 +133,22 @@ typedef enum {
     CTSHELL_EVT_DOWN,
     CTSHELL_EVT_LEFT,
     CTSHELL_EVT_RIGHT,
-    CTSHELL_EVT_CTRL_C
+    CTSHELL_EVT_CTRL_C,
+    CTSHELL_EVT_HOME,
+    CTSHELL_EVT_END,
+    CTSHELL_EVT_DELETE
 } ctshell_key_event_t;
 
-typedef struct {
-    uint8_t state;
-    char input;
-    uint8_t next_state;
-    ctshell_key_event_t evt;
-} ctshell_dfa_trans_t;
-
 typedef enum {
     CTSHELL_DFA_ROOT = 0,
-    CTSHELL_DFA_ESC,
-    CTSHELL_DFA_CSI,
-    CTSHELL_DFA_TILDE
+    CTSHELL_DFA_ESC,       // ESC
+    CTSHELL_DFA_CSI,       // ESC [
+    CTSHELL_DFA_CSI_HOME,  // ESC [ 1, ESC [ 7
+    CTSHELL_DFA_CSI_DEL,   // ESC [ 3
+    CTSHELL_DFA_CSI_END,   // ESC [ 4, ESC [ 8
+    CTSHELL_DFA_CSI_PARAM, // ESC [ with any other parameter bytes
+    CTSHELL_DFA_SS3,       // ESC O
+    CTSHELL_DFA_STATE_COUNT
 } ctshell_dfa_state_t;
 
 #ifdef CONFIG_CTSHELL_USE_FS
@@ -142,20 +181,150 @@ typedef struct {
     int (*mkdir)(const char *path);
     int (*lseek)(int fd, long offset, int whence);
 } ctshell_fs_drv_t;
+
+/**
+ * @brief Output file of a `> file` or `>> file` redirection.
+ *
+ * Output reaches the file in writes of CONFIG_CTSHELL_FS_BLOCK_SIZE bytes,
+ * the last partial block once the command line has ended or was aborted.
+ */
+typedef struct {
+    int fd;
+    uint16_t len;
+    uint8_t open;
+    uint8_t failed; // a write came up short, the rest is dropped
+    char buf[CONFIG_CTSHELL_FS_BLOCK_SIZE];
+} ctshell_file_sink_t;
 #endif
 
+typedef struct ctshell_ctx ctshell_ctx_t;
+
+#ifdef CONFIG_CTSHELL_USE_PIPE
 /**
- * @brief Main shell context.
+ * @brief Bounded buffer between two commands of a pipeline.
+ *
+ * Unread data is buf[start, start + len); the writer compacts it to the
+ * front when it runs out of room and runs the reader while it stays full.
  */
+typedef struct ctshell_pipe {
+    struct ctshell_job *reader;
+    uint16_t start;
+    uint16_t len;
+    uint8_t eof; // the writing command has ended
+    char buf[CONFIG_CTSHELL_PIPE_BUF_SIZE];
+} ctshell_pipe_t;
+#endif
+
+#ifdef CONFIG_CTSHELL_USE_RPC
+/*
+ * Framed RPC packets: type, 16-bit little-endian sequence number, payload,
+ * then a little-endian CRC-16/CCITT-FALSE of all of it. Each packet is COBS
+ * encoded and ends with a 0x00 delimiter. The `rpc` command switches the
+ * link from text to packets and answers with a lone 0x00; CTSHELL_RPC_CLOSE
+ * switches it back, as do CTSHELL_RPC_TIMEOUT ms in an unfinished packet and
+ * four undecodable packets in a row.
+ */
+enum {
+    CTSHELL_RPC_CALL_NAME = 0x01, // argv as NUL-terminated strings
+    CTSHELL_RPC_CALL_ID   = 0x02, // 16-bit command id, then argv[1..] as NUL-terminated strings
+    CTSHELL_RPC_LIST      = 0x03, // "id path" lines of every runnable command, for CALL_ID
+    CTSHELL_RPC_CLOSE     = 0x04, // back to text mode
+    CTSHELL_RPC_OUTPUT    = 0x81, // a piece of the request's output
+    CTSHELL_RPC_DONE      = 0x82, // 32-bit return code, the request has ended
+    CTSHELL_RPC_ERROR     = 0x83, // 32-bit CTSHELL_RPC_ERR_*, the request did not run
+    CTSHELL_RPC_EVENT     = 0x84, // output outside any request, sequence number 0
+};
+
+enum {
+    CTSHELL_RPC_ERR_FRAME = 1,     // bad CRC, truncated or longer than CTSHELL_RPC_FRAME_SIZE
+    CTSHELL_RPC_ERR_TYPE,          // unknown packet type
+    CTSHELL_RPC_ERR_ARGS,          // unterminated argument or more than CTSHELL_MAX_ARGS
+    CTSHELL_RPC_ERR_NOT_FOUND,     // no runnable command by that name or id
+};
+
 typedef struct {
+    uint8_t open;     // the link carries packets instead of text
+    uint8_t code;     // COBS code of the block being decoded, 0 before the first one
+    uint8_t left;     // bytes left in that block
+    uint8_t overflow; // the packet did not fit in `in`
+    uint8_t bad;      // undecodable packets in a row
+    uint32_t rx_tick; // when the unfinished packet last received a byte
+    uint16_t in_len;
+    uint16_t out_len;
+    uint8_t in[CONFIG_CTSHELL_RPC_FRAME_SIZE];  // decoded request, argv points into it while it runs
+    uint8_t out[CONFIG_CTSHELL_RPC_FRAME_SIZE]; // output packet being filled
+} ctshell_rpc_t;
+#endif
+
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+/**
+ * @brief One invocation of an asynchronous command.
+ *
+ * Locals of the command function do not survive a yield, keep anything that
+ * must in the job state (CTSHELL_JOB_STATE).
+ */
+typedef struct ctshell_job {
+    ctshell_ctx_t *ctx;
+    const struct ctshell_cmd_t *cmd;
+    int argc;
+    char **argv;
+
+    int pt;           // resume point, 0 on the first call
+    uint32_t wake;    // get_tick value to resume at while sleeping
+    uint8_t sleeping;
+    uint8_t active;
+
+    /* optional, set by the command, called if the job is cancelled */
+    void (*cleanup)(struct ctshell_job *job);
+
+#ifdef CONFIG_CTSHELL_USE_PIPE
+    ctshell_pipe_t *in;  // read with ctshell_job_read, NULL reads as end of input
+    ctshell_pipe_t *out; // NULL for the console
+#endif
+
+#ifdef CONFIG_CTSHELL_USE_STATS
+    ctshell_stats_mark_t stats_start;
+    uint32_t stats_out; // bytes written by the job itself, other jobs interleave
+#endif
+
+    char *argv_buf[CONFIG_CTSHELL_MAX_ARGS];
+    char arg_buf[CONFIG_CTSHELL_LINE_BUF_SIZE]; // line_buf is reused while the job runs
+    union {
+        uint8_t bytes[CONFIG_CTSHELL_ASYNC_STATE_SIZE];
+        uint64_t align_u64;
+        double align_double;
+        void *align_ptr;
+    } state;
+} ctshell_job_t;
+#endif
+
+/**
+ * @brief Main shell context.
+ */
+struct ctshell_ctx {
     ctshell_io_t io;
     void *priv;
 
+    /*
+     * single-producer/single-consumer ring with free-running indices,
+     * each index on its own cache line to avoid false sharing
+     */
     char fifo_buf[CONFIG_CTSHELL_FIFO_SIZE];
-    volatile uint16_t fifo_head;
-    volatile uint16_t fifo_tail;
+    uint32_t fifo_head CTSHELL_CACHE_ALIGNED; // written by ctshell_input
+    uint32_t fifo_tail CTSHELL_CACHE_ALIGNED; // written by ctshell_poll
+
+    char tx_buf[CONFIG_CTSHELL_TX_BUF_SIZE] CTSHELL_CACHE_ALIGNED;
+    uint16_t tx_len;
 
-    ctshell_var_t vars[CONFIG_CTSHELL_VAR_MAX_COUNT];
+    uint16_t var_index[CTSHELL_VAR_INDEX_SIZE]; // arena offset + 1 of a variable, 0 if empty
+    uint16_t var_count;
+    uint16_t var_used; // bytes of var_arena holding variables
+    char var_arena[CONFIG_CTSHELL_VAR_ARENA_SIZE];
+    /*
+     * Gap buffer: the text before the cursor is line_buf[0, cur_pos), the
+     * text after it is the NUL-terminated string ending at the last byte of
+     * line_buf. line_buf is only a contiguous string while a line executes.
+     */
     char line_buf[CONFIG_CTSHELL_LINE_BUF_SIZE];
     uint16_t line_len;
     uint16_t cur_pos;
@@ -168,17 +337,51 @@ typedef struct {
     volatile int sigint;
     jmp_buf jump_env;
     int is_executing;
+    const struct ctshell_cmd_t *cmd; // the command running, whose schema ctshell_parse uses
+    uint8_t no_echo;
+    uint8_t quiet;      // lines run between markers without echo, editing or prompt
+    uint8_t quiet_long; // the quiet line being received did not fit in line_buf
+    uint8_t quiet_lf;   // `quiet off` ended with CR, an LF right after it belongs to that line
+    uint8_t tx_eol;     // the console output so far ends with '\n'
+    uint16_t quiet_seq; // sequence number of the last quiet line
+
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+    ctshell_job_t jobs[CONFIG_CTSHELL_JOB_MAX]; // job id is the slot index + 1
+    ctshell_job_t *fg;   // the foreground job, NULL while the prompt is live
+    uint8_t hide_line;   // erase the edit line before the next output
+    uint8_t line_hidden; // background output replaced the edit line
+    uint8_t hidden_eol;  // that output ended with a newline
+#endif
+
+#ifdef CONFIG_CTSHELL_USE_PIPE
+    ctshell_pipe_t pipes[CONFIG_CTSHELL_PIPE_MAX];
+    ctshell_pipe_t *out_pipe; // where ctshell_write goes while a pipeline runs
+#endif
+
+#ifdef CONFIG_CTSHELL_USE_STATS
+    uint32_t out_bytes; // everything written so far, sampled around each command
+    uint32_t stats_dropped; // runs of commands past CONFIG_CTSHELL_STATS_SIZE
+    ctshell_cmd_stats_t stats[CONFIG_CTSHELL_STATS_SIZE]; // by position in the command section
+#endif
+
+#ifdef CONFIG_CTSHELL_USE_RPC
+    volatile uint8_t rpc_mode; // set by the `rpc` command, Ctrl+C is data from then on
+    ctshell_rpc_t rpc;
+#endif
 
 #ifdef CONFIG_CTSHELL_USE_FS
     const ctshell_fs_drv_t *fs_drv;
     char cwd[CONFIG_CTSHELL_FS_PATH_MAX];
+    ctshell_file_sink_t sink;
+    ctshell_file_sink_t *out_file; // where ctshell_write goes while a redirected command runs
 #endif
-} ctshell_ctx_t;
+};
 
 typedef enum {
     CTSHELL_ATTR_NONE   = 0,
     CTSHELL_ATTR_MENU   = (1 << 0),
     CTSHELL_ATTR_HIDDEN = (1 << 1),
+    CTSHELL_ATTR_ASYNC  = (1 << 2),
 } ctshell_cmd_attr_t;
 
 #ifdef CONFIG_CTSHELL_USE_FS
@@ -193,21 +396,56 @@ typedef enum {
 
 typedef int (*ctshell_cmd_func_t)(int argc, char *argv[]);
 
+typedef enum {
+    CTSHELL_ARG_BOOL,
+    CTSHELL_ARG_INT,
+    CTSHELL_ARG_STR,
+    CTSHELL_ARG_VERB,
+#ifdef CONFIG_CTSHELL_USE_DOUBLE
+    CTSHELL_ARG_DOUBLE,
+#endif
+} ctshell_arg_type_t;
+
+/**
+ * @brief One entry of a command's argument schema.
+ *
+ * A verb is matched as the first argument only, every other entry is a flag
+ * anywhere on the line, followed by its value unless it is a bool.
+ */
+typedef struct {
+    const char *flag;   // "-n", or the verb itself
+    const char *value;  // value name shown in the usage text, NULL for bool and verb
+    ctshell_arg_type_t type;
+} ctshell_arg_spec_t;
+
+#define CTSHELL_OPT_BOOL(_flag)        { _flag, NULL, CTSHELL_ARG_BOOL }
+#define CTSHELL_OPT_INT(_flag, _val)   { _flag, _val, CTSHELL_ARG_INT }
+#define CTSHELL_OPT_STR(_flag, _val)   { _flag, _val, CTSHELL_ARG_STR }
+#define CTSHELL_OPT_VERB(_verb)        { _verb, NULL, CTSHELL_ARG_VERB }
+#ifdef CONFIG_CTSHELL_USE_DOUBLE
+#define CTSHELL_OPT_DOUBLE(_flag, _val) { _flag, _val, CTSHELL_ARG_DOUBLE }
+#endif
+
+/* results of ctshell_parse, looked up by the position of the entry in the schema */
+typedef struct {
+    char **argv;
+    uint8_t pos[CONFIG_CTSHELL_MAX_ARGS]; // argv index of the value, or of the flag itself, 0 if absent
+} ctshell_args_t;
+
 typedef struct ctshell_cmd_t {
     const char *name;
     const char *desc;
     ctshell_cmd_func_t func;
     uint32_t attrs;
     const struct ctshell_cmd_t *parent;
+    const ctshell_arg_spec_t *args; // optional schema for ctshell_parse, usage and completion
+    uint8_t nargs;
 } ctshell_cmd_t;
 
-#if defined(__GNUC__) || defined(__clang__) || defined(__CC_ARM)
-#define CTSHELL_SECTION(x) __attribute__((section(x)))
-#define CTSHELL_USED       __attribute__((used))
-#define CTSHELL_ALIGN      __attribute__((aligned(sizeof(void*))))
-#else
-#error "Current compiler is not supported yet."
-#endif
+/* number of entries in a schema array, which must fit ctshell_args_t */
+#define CTSHELL_ARGS_COUNT(_args) \
+    ((uint8_t) (sizeof(_args) / sizeof((_args)[0]) * \
+                sizeof(char[sizeof(_args) / sizeof((_args)[0]) <= CONFIG_CTSHELL_MAX_ARGS ? 1 : -1])))
 
 #define CTSHELL_EXPORT_CMD(_name, _func, _desc, _attr) \
     static const ctshell_cmd_t __ctshell_cmd_##_name \
@@ -234,15 +472,69 @@ typedef struct ctshell_cmd_t {
         .attrs  = CTSHELL_ATTR_NONE \
     }
 
-typedef enum {
-    CTSHELL_ARG_BOOL,
-    CTSHELL_ARG_INT,
-    CTSHELL_ARG_STR,
-    CTSHELL_ARG_VERB,
-#ifdef CONFIG_CTSHELL_USE_DOUBLE
-    CTSHELL_ARG_DOUBLE,
+/* like CTSHELL_EXPORT_CMD, with a static const ctshell_arg_spec_t array describing its options */
+#define CTSHELL_EXPORT_CMD_ARGS(_name, _func, _desc, _args, _attr) \
+    static const ctshell_cmd_t __ctshell_cmd_##_name \
+    CTSHELL_SECTION("ctshell_cmd_section") \
+    CTSHELL_USED \
+    CTSHELL_ALIGN = { \
+        .name   = #_name, \
+        .desc   = _desc, \
+        .func   = _func, \
+        .parent = NULL, \
+        .attrs  = _attr, \
+        .args   = _args, \
+        .nargs  = CTSHELL_ARGS_COUNT(_args) \
+    }
+
+#define CTSHELL_EXPORT_SUBCMD_ARGS(_parent, _name, _func, _desc, _args) \
+    extern const ctshell_cmd_t __ctshell_cmd_##_parent; \
+    static const ctshell_cmd_t __ctshell_cmd_##_parent##_##_name \
+    CTSHELL_SECTION("ctshell_cmd_section") \
+    CTSHELL_USED \
+    CTSHELL_ALIGN = { \
+        .name   = #_name, \
+        .desc   = _desc, \
+        .func   = _func, \
+        .parent = &__ctshell_cmd_##_parent, \
+        .attrs  = CTSHELL_ATTR_NONE, \
+        .args   = _args, \
+        .nargs  = CTSHELL_ARGS_COUNT(_args) \
+    }
+
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+/* returned by an asynchronous command that has not finished yet */
+#define CTSHELL_PENDING (-0x7FFF - 1)
+
+/* returned by ctshell_job_read once the writing command has ended */
+#define CTSHELL_EOF (-1)
+
+typedef int (*ctshell_async_func_t)(ctshell_job_t *job);
+
+#define CTSHELL_EXPORT_ASYNC_CMD(_name, _func, _desc, _attr) \
+    CTSHELL_EXPORT_CMD(_name, (ctshell_cmd_func_t) (void (*)(void)) (_func), _desc, (_attr) | CTSHELL_ATTR_ASYNC)
+
+/* per-invocation state, zeroed when the job starts */
+#define CTSHELL_JOB_STATE(job, type) \
+    ((void) sizeof(char[sizeof(type) <= CONFIG_CTSHELL_ASYNC_STATE_SIZE ? 1 : -1]), \
+     (type *) (job)->state.bytes)
+
+/*
+ * Protothread-style control flow. Each macro may only appear once per line,
+ * and not inside a switch of the command's own.
+ */
+#define CTSHELL_ASYNC_BEGIN(job) switch ((job)->pt) { case 0:
+#define CTSHELL_ASYNC_END(job)   } return 0
+
+#define CTSHELL_ASYNC_YIELD(job) \
+    do { (job)->pt = __LINE__; return CTSHELL_PENDING; case __LINE__:; } while (0)
+
+#define CTSHELL_ASYNC_WAIT_UNTIL(job, cond) \
+    do { (job)->pt = __LINE__; if (0) { case __LINE__:; } if (!(cond)) return CTSHELL_PENDING; } while (0)
+
+#define CTSHELL_ASYNC_SLEEP(job, ms) \
+    do { ctshell_job_sleep((job), (ms)); CTSHELL_ASYNC_YIELD(job); } while (0)
 #endif
-} ctshell_arg_type_t;
 
 typedef struct {
     const char *flag;
@@ -267,11 +559,27 @@ typedef struct {
 } ctshell_arg_parser_t;
 
 void ctshell_init(ctshell_ctx_t *ctx, ctshell_io_t io, void *priv);
+void ctshell_deinit(ctshell_ctx_t *ctx);
 void ctshell_input(ctshell_ctx_t *ctx, char byte);
+uint16_t ctshell_input_buf(ctshell_ctx_t *ctx, const char *data, uint16_t len);
 void ctshell_poll(ctshell_ctx_t *ctx);
+uint32_t ctshell_next_timeout(ctshell_ctx_t *ctx);
+void ctshell_idle(ctshell_ctx_t *ctx);
 void ctshell_printf(const char *fmt, ...);
+void ctshell_ctx_printf(ctshell_ctx_t *ctx, const char *fmt, ...);
+ctshell_ctx_t *ctshell_current_ctx(void);
+void ctshell_flush(ctshell_ctx_t *ctx);
+void ctshell_set_echo(ctshell_ctx_t *ctx, int on);
+void ctshell_set_quiet(ctshell_ctx_t *ctx, int on);
 void ctshell_check_abort(ctshell_ctx_t *ctx);
 void ctshell_delay(ctshell_ctx_t *ctx, uint32_t ms);
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+void ctshell_job_sleep(ctshell_job_t *job, uint32_t ms);
+#endif
+#ifdef CONFIG_CTSHELL_USE_PIPE
+int ctshell_job_read(ctshell_job_t *job, char *buf, int len);
+int ctshell_job_readline(ctshell_job_t *job, const char **line);
+#endif
 void ctshell_args_init(ctshell_arg_parser_t *parser, int argc, char *argv[]);
 void ctshell_expect_int(ctshell_arg_parser_t *p, const char *flag, const char *key);
 void ctshell_expect_str(ctshell_arg_parser_t *p, const char *flag, const char *key);
@@ -288,7 +596,17 @@ int ctshell_get_bool(ctshell_arg_parser_t *p, const char *key);
 double ctshell_get_double(ctshell_arg_parser_t *p, const char *key);
 #endif
 int ctshell_has(ctshell_arg_parser_t *p, const char *key);
+int ctshell_parse(ctshell_args_t *a, int argc, char *argv[]);
+void ctshell_usage(void);
+int ctshell_arg_has(const ctshell_args_t *a, int idx);
+int ctshell_arg_int(const ctshell_args_t *a, int idx, int def);
+const char *ctshell_arg_str(const ctshell_args_t *a, int idx, const char *def);
+#ifdef CONFIG_CTSHELL_USE_DOUBLE
+double ctshell_arg_double(const ctshell_args_t *a, int idx, double def);
+#endif
 #ifdef CONFIG_CTSHELL_USE_FS
+void ctshell_fs_init(ctshell_ctx_t *ctx, const ctshell_fs_drv_t *drv);
+void ctshell_fs_resolve_path(const char *cwd, const char *path, char *out_buf, size_t buf_size);
 #ifdef CONFIG_CTSHELL_USE_FS_FATFS
 extern void ctshell_fatfs_init(ctshell_ctx_t *ctx);
 #endif
@@ -12,19 +12,44 @@
 //#define CONFIG_CTSHELL_USE_DOUBLE
 //#define CONFIG_CTSHELL_USE_FS
 //#define CONFIG_CTSHELL_USE_FS_FATFS
+//#define CONFIG_CTSHELL_USE_TLS
+//#define CONFIG_CTSHELL_USE_STATS
+//#define CONFIG_CTSHELL_USE_ASYNC
+//#define CONFIG_CTSHELL_USE_PIPE
+//#define CONFIG_CTSHELL_USE_RPC
 
 /* ================= Resource Limits ================= */
 #define CONFIG_CTSHELL_CMD_NAME_MAX_LEN    16
+#define CONFIG_CTSHELL_CMD_INDEX_SIZE      64
 #define CONFIG_CTSHELL_LINE_BUF_SIZE       128
 #define CONFIG_CTSHELL_MAX_ARGS            16
 #define CONFIG_CTSHELL_HISTORY_SIZE        5
 #define CONFIG_CTSHELL_VAR_MAX_COUNT       8
+#define CONFIG_CTSHELL_VAR_ARENA_SIZE      256
 #define CONFIG_CTSHELL_VAR_NAME_LEN        16
 #define CONFIG_CTSHELL_VAR_VAL_LEN         32
 #define CONFIG_CTSHELL_FIFO_SIZE           128
+#define CONFIG_CTSHELL_CACHE_LINE_SIZE     32
+#define CONFIG_CTSHELL_TX_BUF_SIZE         128
 #ifdef CONFIG_CTSHELL_USE_FS
 #define CONFIG_CTSHELL_FS_PATH_MAX         256
 #define CONFIG_CTSHELL_FS_NAME_MAX         64
+#define CONFIG_CTSHELL_FS_BLOCK_SIZE       512
+#endif
+#ifdef CONFIG_CTSHELL_USE_STATS
+#define CONFIG_CTSHELL_STATS_SIZE          64
+#endif
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+#define CONFIG_CTSHELL_ASYNC_STATE_SIZE    32
+#define CONFIG_CTSHELL_JOB_MAX             4
+#endif
+#ifdef CONFIG_CTSHELL_USE_PIPE
+#define CONFIG_CTSHELL_PIPE_BUF_SIZE       64
+#define CONFIG_CTSHELL_PIPE_MAX            2
+#endif
+#ifdef CONFIG_CTSHELL_USE_RPC
+#define CONFIG_CTSHELL_RPC_FRAME_SIZE      256
+#define CONFIG_CTSHELL_RPC_TIMEOUT         1000
 #endif
 #define CONFIG_CTSHELL_PROMPT              "ctsh>> "
 
@@ -12,16 +12,45 @@
 #include "ff.h"
 
 #define MAX_OPEN_FILES  2
+#define MAX_OPEN_DIRS   2
 
 typedef struct {
     FIL fil;
     uint8_t used;
 } fatfs_file_slot_t;
 
+typedef struct {
+    DIR dir;
+    uint8_t used;
+} fatfs_dir_slot_t;
+
+/*
+ * Shared by every shell using this driver. Slots are claimed atomically, so
+ * shells on different threads can use the volume at the same time as long as
+ * FatFs itself is built with FF_FS_REENTRANT.
+ */
 static FATFS fs;
-static DIR dir_obj;
-static FILINFO fno;
+static uint8_t fs_mounted;
 static fatfs_file_slot_t file_pool[MAX_OPEN_FILES];
+static fatfs_dir_slot_t dir_pool[MAX_OPEN_DIRS];
+
+static int slot_claim(uint8_t *used) {
+#if defined(__ATOMIC_ACQUIRE)
+    return __atomic_exchange_n(used, 1, __ATOMIC_ACQUIRE) == 0;
+#else
+    if (*used) return 0;
+    *used = 1;
+    return 1;
+#endif
+}
+
+static void slot_release(uint8_t *used) {
+#if defined(__ATOMIC_RELEASE)
+    __atomic_store_n(used, 0, __ATOMIC_RELEASE);
+#else
+    *used = 0;
+#endif
+}
 
 static void mount_fs(void) {
     f_mount(NULL, "", 0);
@@ -51,7 +80,7 @@ static const char *clean_path(const char *path) {
 static int fatfs_open(const char *path, int flags) {
     int fd = -1;
     for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (!file_pool[i].used) {
+        if (slot_claim(&file_pool[i].used)) {
             fd = i;
             break;
         }
@@ -69,7 +98,6 @@ static int fatfs_open(const char *path, int flags) {
         res = f_open(&file_pool[fd].fil, real_path, mode);
     }
     if (res == FR_OK) {
-        file_pool[fd].used = 1;
         if ((flags & CTSHELL_O_APPEND) && f_size(&file_pool[fd].fil) > 0) {
             f_lseek(&file_pool[fd].fil, f_size(&file_pool[fd].fil));
         }
@@ -78,14 +106,15 @@ static int fatfs_open(const char *path, int flags) {
     if (res != FR_NO_FILE && res != FR_NO_PATH) {
         ctshell_error("Open '%s' failed, ret=%d\r\n", real_path, res);
     }
+    slot_release(&file_pool[fd].used);
     return -1;
 }
 
 static int fatfs_close(int fd) {
     if (fd >= 0 && fd < MAX_OPEN_FILES && file_pool[fd].used) {
         FRESULT res = f_close(&file_pool[fd].fil);
-        file_pool[fd].used = 0;
         memset(&file_pool[fd].fil, 0, sizeof(FIL));
+        slot_release(&file_pool[fd].used);
         return (res == FR_OK) ? 0 : -1;
     }
     return -1;
@@ -142,21 +171,34 @@ static int fatfs_lseek(int fd, long offset, int whence) {
 
 static int fatfs_opendir(const char *path, void **dir_handle) {
     const char *real_path = clean_path(path);
+    fatfs_dir_slot_t *slot = NULL;
+    for (int i = 0; i < MAX_OPEN_DIRS; i++) {
+        if (slot_claim(&dir_pool[i].used)) {
+            slot = &dir_pool[i];
+            break;
+        }
+    }
+    if (!slot) {
+        ctshell_error("Too many opened directories\r\n");
+        return -1;
+    }
 
-    FRESULT res = f_opendir(&dir_obj, real_path);
+    FRESULT res = f_opendir(&slot->dir, real_path);
     if (res == FR_DISK_ERR || res == FR_NOT_READY) {
         mount_fs();
-        res = f_opendir(&dir_obj, real_path);
+        res = f_opendir(&slot->dir, real_path);
     }
     if (res == FR_OK) {
-        *dir_handle = &dir_obj;
+        *dir_handle = slot;
         return 0;
     }
+    slot_release(&slot->used);
     return -1;
 }
 
 static int fatfs_readdir(void *dir_handle, ctshell_dirent_t *entry) {
-    if (f_readdir((DIR *) dir_handle, &fno) == FR_OK && fno.fname[0] != 0) {
+    FILINFO fno;
+    if (f_readdir(&((fatfs_dir_slot_t *) dir_handle)->dir, &fno) == FR_OK && fno.fname[0] != 0) {
         strncpy(entry->name, fno.fname, CONFIG_CTSHELL_FS_NAME_MAX - 1);
         entry->name[CONFIG_CTSHELL_FS_NAME_MAX - 1] = '\0';
         entry->size = fno.fsize;
@@ -167,7 +209,9 @@ static int fatfs_readdir(void *dir_handle, ctshell_dirent_t *entry) {
 }
 
 static int fatfs_closedir(void *dir_handle) {
-    f_closedir((DIR *) dir_handle);
+    fatfs_dir_slot_t *slot = (fatfs_dir_slot_t *) dir_handle;
+    f_closedir(&slot->dir);
+    slot_release(&slot->used);
     return 0;
 }
 
@@ -289,8 +333,10 @@ const ctshell_fs_drv_t fatfs_drv = {
 
 extern void ctshell_fs_init(ctshell_ctx_t *ctx, const ctshell_fs_drv_t *drv);
 void ctshell_fatfs_init(ctshell_ctx_t *ctx) {
-    memset(file_pool, 0, sizeof(file_pool));
-    mount_fs();
+    // the volume is mounted once, further shells only attach to it
+    if (slot_claim(&fs_mounted)) {
+        mount_fs();
+    }
     ctshell_fs_init(ctx, &fatfs_drv);
 }
 #endif
@@ -15,6 +15,7 @@
 
 typedef struct {
     uart_port_t uart_num;
+    TaskHandle_t shell_task;
     ctshell_ctx_t ctx;
 } ctshell_esp32_priv_t;
 
@@ -29,15 +30,33 @@ static uint32_t shell_get_tick(void) {
     return (uint32_t) (esp_timer_get_time() / 1000ULL);
 }
 
+/* esp_timer rather than the CPU cycle counter, which differs between cores */
+static uint32_t shell_get_cycles(void) {
+    return (uint32_t) esp_timer_get_time();
+}
+
+/* the rx task notifies the shell task, which otherwise sleeps until its next deadline */
+static void shell_idle(uint32_t ms, void *p) {
+    (void) p;
+    TickType_t ticks = portMAX_DELAY;
+    if (ms != CTSHELL_WAIT_FOREVER) {
+        ticks = (TickType_t) ((ms * (uint64_t) configTICK_RATE_HZ + 999) / 1000);
+    }
+    ulTaskNotifyTake(pdTRUE, ticks);
+}
+
 static void shell_rx_task(void *arg) {
     ctshell_esp32_priv_t *obj = arg;
-    uint8_t ch;
+    char buf[64];
 
     while (1) {
-        int len = uart_read_bytes(obj->uart_num, &ch, 1, portMAX_DELAY);
-
+        // block for the first byte, then take whatever else has already arrived
+        int len = uart_read_bytes(obj->uart_num, buf, 1, portMAX_DELAY);
         if (len > 0) {
-            ctshell_input(&obj->ctx, ch);
+            int more = uart_read_bytes(obj->uart_num, buf + 1, sizeof(buf) - 1, 0);
+            if (more > 0) len += more;
+            ctshell_input_buf(&obj->ctx, buf, (uint16_t) len);
+            xTaskNotifyGive(obj->shell_task);
         }
     }
 }
@@ -47,7 +66,7 @@ static void shell_task(void *arg) {
 
     while (1) {
         ctshell_poll(&obj->ctx);
-        vTaskDelay(pdMS_TO_TICKS(5));
+        ctshell_idle(&obj->ctx);
     }
 }
 
@@ -77,9 +96,13 @@ void ctshell_esp32_init(void) {
             {
                     .write = shell_write,
                     .get_tick = shell_get_tick,
+                    .get_cycles = shell_get_cycles,
+                    .cycles_hz = 1000000,
+                    .idle = shell_idle,
             };
     ctshell_init(&priv.ctx, io, &priv);
 
+    xTaskCreate(shell_task, "ctshell", CONFIG_CTSHELL_ESP32_TASK_STACK, &priv, CONFIG_CTSHELL_ESP32_TASK_PRIO,
+                &priv.shell_task);
     xTaskCreate(shell_rx_task, "ctshell_rx", CONFIG_CTSHELL_ESP32_RX_TASK_STACK, &priv, 5, NULL);
-    xTaskCreate(shell_task, "ctshell", CONFIG_CTSHELL_ESP32_TASK_STACK, &priv, CONFIG_CTSHELL_ESP32_TASK_PRIO, NULL);
 }
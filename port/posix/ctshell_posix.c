@@ -12,23 +12,60 @@
 #include <fcntl.h>
 #include <time.h>
 #include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+typedef struct {
+    ctshell_posix_work_t fn;
+    void *arg;
+} ctshell_posix_work_item_t;
 
 typedef struct {
     struct termios old_termios;
+    int wake_rd;
+    int wake_wr;
+    volatile sig_atomic_t stop;
+    pthread_mutex_t lock;
+    ctshell_posix_work_item_t queue[CONFIG_CTSHELL_POSIX_POST_QUEUE];
+    uint16_t q_head;
+    uint16_t q_count;
+    /* input the FIFO could not take while an asynchronous command runs */
+    char pend[CONFIG_CTSHELL_POSIX_READ_CHUNK];
+    size_t pend_len;
+    int eof;
 } ctshell_posix_priv_t;
 
 static ctshell_ctx_t *g_ctx;
-static ctshell_posix_priv_t priv;
-
-static void inject_ansi(ctshell_ctx_t *ctx, const char *ansi_seq) {
-    while (*ansi_seq) {
-        ctshell_input(ctx, *ansi_seq++);
-    }
-}
+static ctshell_posix_priv_t priv = {
+        .wake_rd = -1,
+        .wake_wr = -1,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 static void posix_shell_write(const char *str, uint16_t len, void *p) {
     (void) p;
-    write(STDOUT_FILENO, str, len);
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, str, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                /* stdin and stdout usually share the non-blocking tty */
+                struct pollfd pfd = {.fd = STDOUT_FILENO, .events = POLLOUT};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return;
+        }
+        str += n;
+        len -= (uint16_t) n;
+    }
 }
 
 static uint32_t posix_get_tick(void) {
@@ -37,6 +74,176 @@ static uint32_t posix_get_tick(void) {
     return (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
 }
 
+static uint32_t posix_get_cycles(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec);
+}
+
+static int posix_wake_open(void) {
+#ifdef __linux__
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd >= 0) {
+        priv.wake_rd = fd;
+        priv.wake_wr = fd;
+        return 0;
+    }
+#endif
+    int fds[2];
+    if (pipe(fds) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    priv.wake_rd = fds[0];
+    priv.wake_wr = fds[1];
+    return 0;
+}
+
+static void posix_wake_close(void) {
+    if (priv.wake_wr >= 0 && priv.wake_wr != priv.wake_rd) {
+        close(priv.wake_wr);
+    }
+    if (priv.wake_rd >= 0) {
+        close(priv.wake_rd);
+    }
+    priv.wake_rd = -1;
+    priv.wake_wr = -1;
+}
+
+static void posix_wake_drain(void) {
+    uint64_t buf[8];
+    while (read(priv.wake_rd, buf, sizeof(buf)) > 0) {
+        if (priv.wake_rd == priv.wake_wr) break;
+    }
+}
+
+static int posix_timeout(uint32_t ms) {
+    if (ms == CTSHELL_WAIT_FOREVER) return -1;
+    return ms > INT_MAX ? INT_MAX : (int) ms;
+}
+
+/*
+ * keeps what the FIFO did not take, in order. The terminal is only read
+ * while the stash is empty, so a read chunk always fits.
+ */
+static void posix_stash(ctshell_ctx_t *ctx, const char *buf, size_t len) {
+    int interrupt = 1;
+#ifdef CONFIG_CTSHELL_USE_RPC
+    // a packet byte, it must not overtake the stash
+    interrupt = !ctx->rpc_mode;
+#endif
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == CTSHELL_KEY_CTRL_C && interrupt) {
+            ctshell_input(ctx, buf[i]);
+        } else if (priv.pend_len < sizeof(priv.pend)) {
+            priv.pend[priv.pend_len++] = buf[i];
+        }
+    }
+}
+
+/* moves what fits of the stash into the FIFO, without running the shell */
+static void posix_queue_pending(ctshell_ctx_t *ctx) {
+    if (priv.pend_len == 0) return;
+    size_t n = ctshell_input_buf(ctx, priv.pend, (uint16_t) priv.pend_len);
+    priv.pend_len -= n;
+    memmove(priv.pend, priv.pend + n, priv.pend_len);
+}
+
+/* queues a chunk without running the shell, safe from inside a command */
+static void posix_queue(ctshell_ctx_t *ctx, const char *buf, size_t len) {
+    size_t off = 0;
+    posix_queue_pending(ctx);
+    if (priv.pend_len == 0) {
+        off = ctshell_input_buf(ctx, buf, (uint16_t) (len > UINT16_MAX ? UINT16_MAX : len));
+    }
+    posix_stash(ctx, buf + off, len - off);
+}
+
+static void posix_feed_pending(ctshell_ctx_t *ctx) {
+    while (priv.pend_len > 0) {
+        size_t n = ctshell_input_buf(ctx, priv.pend, (uint16_t) priv.pend_len);
+        if (n == 0) return;
+        priv.pend_len -= n;
+        memmove(priv.pend, priv.pend + n, priv.pend_len);
+        ctshell_poll(ctx);
+    }
+}
+
+/*
+ * feed a chunk to the core. What the FIFO does not take is stashed before
+ * anything runs, so input read by a command sleeping in posix_idle queues
+ * up behind it. The FIFO stays full while an asynchronous command runs.
+ */
+static void posix_feed(ctshell_ctx_t *ctx, const char *buf, size_t len) {
+    posix_queue(ctx, buf, len);
+    ctshell_poll(ctx);
+    posix_feed_pending(ctx);
+}
+
+/* io.idle: sleeps in ctshell_delay and sleeping nested commands */
+static void posix_idle(uint32_t ms, void *p) {
+    (void) p;
+    struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+    char buf[CONFIG_CTSHELL_POSIX_READ_CHUNK];
+
+    posix_queue_pending(g_ctx);
+    /* with the FIFO and the stash full, the terminal waits until the command returns */
+    if (priv.eof || priv.pend_len > 0) {
+        poll(NULL, 0, posix_timeout(ms));
+        return;
+    }
+    if (poll(&pfd, 1, posix_timeout(ms)) <= 0) return;
+
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n > 0) {
+        posix_queue(g_ctx, buf, (size_t) n);
+    } else if (n == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        priv.eof = 1;
+    }
+}
+
+/* returns -1 on EOF or a fatal error */
+static int posix_read_input(ctshell_ctx_t *ctx) {
+    char buf[CONFIG_CTSHELL_POSIX_READ_CHUNK];
+
+    posix_feed_pending(ctx);
+    if (priv.eof) return -1;
+    while (priv.pend_len == 0) {
+        ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if (n > 0) {
+            posix_feed(ctx, buf, (size_t) n);
+            /* a short read means the kernel buffer is empty */
+            if ((size_t) n < sizeof(buf)) return 0;
+            continue;
+        }
+        if (n == 0) return -1;
+        if (errno == EINTR) continue;
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    return 0;
+}
+
+static void posix_run_posted(ctshell_ctx_t *ctx) {
+    for (;;) {
+        ctshell_posix_work_item_t item;
+
+        pthread_mutex_lock(&priv.lock);
+        if (priv.q_count == 0) {
+            pthread_mutex_unlock(&priv.lock);
+            return;
+        }
+        item = priv.queue[priv.q_head];
+        priv.q_head = (priv.q_head + 1) % CONFIG_CTSHELL_POSIX_POST_QUEUE;
+        priv.q_count--;
+        pthread_mutex_unlock(&priv.lock);
+
+        item.fn(ctx, item.arg);
+    }
+}
+
 int ctshell_posix_init(ctshell_ctx_t *ctx) {
     if (ctx == NULL) {
         return -1;
@@ -66,11 +273,20 @@ int ctshell_posix_init(ctshell_ctx_t *ctx) {
         return -5;
     }
 
+    if (posix_wake_open() < 0) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &priv.old_termios);
+        return -6;
+    }
 
     ctshell_io_t io = {
             .write = posix_shell_write,
             .get_tick = posix_get_tick,
+            .get_cycles = posix_get_cycles,
+            .cycles_hz = 1000000000u,
+            .idle = posix_idle,
     };
+    priv.pend_len = 0;
+    priv.eof = 0;
     ctshell_init(ctx, io, &priv);
 
     return 0;
@@ -79,56 +295,98 @@ int ctshell_posix_init(ctshell_ctx_t *ctx) {
 void ctshell_posix_deinit(ctshell_ctx_t *ctx) {
     (void) ctx;
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &priv.old_termios);
+    posix_wake_close();
+    ctshell_deinit(ctx);
     g_ctx = NULL;
 }
 
 void ctshell_posix_process_input(ctshell_ctx_t *ctx) {
+    char buf[CONFIG_CTSHELL_POSIX_READ_CHUNK];
+
     if (ctx == NULL || ctx != g_ctx) {
         return;
     }
 
-    char ch;
-    while (read(STDIN_FILENO, &ch, 1) == 1) {
-        if (ch == '\x1b') {
-            char seq[3];
-            if (read(STDIN_FILENO, &seq[0], 1) != 1) {
-                ctshell_input(ctx, ch);
-                continue;
-            }
-            if (read(STDIN_FILENO, &seq[1], 1) != 1) {
-                ctshell_input(ctx, ch);
-                ctshell_input(ctx, seq[0]);
-                continue;
-            }
+    /* input only, the caller's loop runs ctshell_poll */
+    posix_queue_pending(ctx);
+    while (priv.pend_len == 0) {
+        ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        posix_queue(ctx, buf, (size_t) n);
+        /* a short read means the kernel buffer is empty, a stash that the FIFO is full */
+        if ((size_t) n < sizeof(buf)) return;
+    }
+}
 
-            if (seq[0] == '[') {
-                if (seq[1] >= 'A' && seq[1] <= 'D') {
-                    switch (seq[1]) {
-                        case 'A':
-                            inject_ansi(ctx, "\x1b[A");
-                            break;
-                        case 'B':
-                            inject_ansi(ctx, "\x1b[B");
-                            break;
-                        case 'C':
-                            inject_ansi(ctx, "\x1b[C");
-                            break;
-                        case 'D':
-                            inject_ansi(ctx, "\x1b[D");
-                            break;
-                    }
-                } else if (seq[1] == 'H') {
-                    inject_ansi(ctx, "\x1b[H");
-                } else if (seq[1] == 'F') {
-                    inject_ansi(ctx, "\x1b[F");
-                } else if (seq[1] == '3' && read(STDIN_FILENO, &seq[2], 1) == 1 && seq[2] == '~') {
-                    inject_ansi(ctx, "\x1b[3~");
-                }
-            }
-        } else if (ch == 127) {
-            ctshell_input(ctx, '\b');
-        } else {
-            ctshell_input(ctx, ch);
+int ctshell_posix_run(ctshell_ctx_t *ctx) {
+    if (ctx == NULL || ctx != g_ctx) {
+        return -1;
+    }
+
+    struct pollfd fds[2] = {
+            {.fd = STDIN_FILENO, .events = POLLIN},
+            {.fd = priv.wake_rd, .events = POLLIN},
+    };
+
+    priv.stop = 0;
+    while (!priv.stop) {
+        posix_feed_pending(ctx);
+        /* the terminal is left unread while the stash holds input */
+        fds[0].events = priv.pend_len > 0 ? 0 : POLLIN;
+        /* sleep until input, a wakeup or the next asynchronous command deadline */
+        if (poll(fds, 2, posix_timeout(ctshell_next_timeout(ctx))) < 0) {
+            if (errno == EINTR) continue;
+            return -2;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            if (posix_read_input(ctx) < 0) break;
+        } else if (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+            break;
         }
+
+        if (fds[1].revents & POLLIN) {
+            posix_wake_drain();
+            posix_run_posted(ctx);
+        }
+
+        ctshell_poll(ctx);
+    }
+
+    return 0;
+}
+
+/* async-signal-safe */
+void ctshell_posix_wakeup(void) {
+    uint64_t one = 1;
+    if (priv.wake_wr >= 0) {
+        write(priv.wake_wr, &one, priv.wake_rd == priv.wake_wr ? sizeof(one) : 1);
     }
 }
+
+/* async-signal-safe */
+void ctshell_posix_stop(void) {
+    priv.stop = 1;
+    ctshell_posix_wakeup();
+}
+
+int ctshell_posix_post(ctshell_posix_work_t fn, void *arg) {
+    if (fn == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&priv.lock);
+    if (priv.q_count == CONFIG_CTSHELL_POSIX_POST_QUEUE) {
+        pthread_mutex_unlock(&priv.lock);
+        return -2;
+    }
+    uint16_t slot = (priv.q_head + priv.q_count) % CONFIG_CTSHELL_POSIX_POST_QUEUE;
+    priv.queue[slot].fn = fn;
+    priv.queue[slot].arg = arg;
+    priv.q_count++;
+    pthread_mutex_unlock(&priv.lock);
+
+    ctshell_posix_wakeup();
+    return 0;
+}
@@ -11,10 +11,26 @@
 extern "C" {
 #endif
 
+#ifndef CONFIG_CTSHELL_POSIX_READ_CHUNK
+#define CONFIG_CTSHELL_POSIX_READ_CHUNK    256
+#endif
+
+#ifndef CONFIG_CTSHELL_POSIX_POST_QUEUE
+#define CONFIG_CTSHELL_POSIX_POST_QUEUE    16
+#endif
+
+typedef void (*ctshell_posix_work_t)(ctshell_ctx_t *ctx, void *arg);
+
 int ctshell_posix_init(ctshell_ctx_t *ctx);
 void ctshell_posix_deinit(ctshell_ctx_t *ctx);
+/* reads the terminal into the input FIFO without running commands, follow it with ctshell_poll */
 void ctshell_posix_process_input(ctshell_ctx_t *ctx);
 
+int ctshell_posix_run(ctshell_ctx_t *ctx);
+void ctshell_posix_stop(void);
+void ctshell_posix_wakeup(void);
+int ctshell_posix_post(ctshell_posix_work_t fn, void *arg);
+
 #ifdef __cplusplus
 }
 #endif
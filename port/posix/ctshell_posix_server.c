@@ -0,0 +1,691 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // accept4
+#endif
+#include "ctshell_posix_server.h"
+
+#if defined(__linux__)
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#ifndef CONFIG_CTSHELL_USE_TLS
+#error "the socket server polls shells from several threads and needs CONFIG_CTSHELL_USE_TLS"
+#endif
+
+#define TELNET_SE       240
+#define TELNET_IP       244
+#define TELNET_SB       250
+#define TELNET_WILL     251
+#define TELNET_WONT     252
+#define TELNET_DO       253
+#define TELNET_DONT     254
+#define TELNET_IAC      255
+#define TELNET_OPT_ECHO 1
+#define TELNET_OPT_SGA  3
+
+#define SERVER_READ_CHUNK  4096
+#define SERVER_EVENTS      64
+
+typedef enum {
+    TN_DATA = 0,
+    TN_CR,
+    TN_IAC,
+    TN_OPT,
+    TN_SB,
+    TN_SB_IAC,
+} telnet_state_t;
+
+typedef struct server_worker server_worker_t;
+
+typedef struct server_session {
+    ctshell_ctx_t ctx; // first member, inherits the alignment of the allocation
+    int fd;
+    server_worker_t *worker;
+    struct server_session *prev;
+    struct server_session *next;
+    uint8_t tn_state;
+    uint8_t tn_cmd;
+    uint8_t dead;
+    uint8_t want_in;
+    uint8_t want_out;
+    uint16_t pend_len;
+    uint32_t out_len;
+    char pend[SERVER_READ_CHUNK]; // input the FIFO did not take yet
+    char out[CONFIG_CTSHELL_POSIX_SERVER_OUT_BUF];
+} server_session_t;
+
+/*
+ * Each worker owns an epoll set and every session on it; sessions never
+ * migrate, so session state needs no locking. The acceptor hands new
+ * connections over through `pending` and a wakeup eventfd.
+ */
+struct server_worker {
+    pthread_t thread;
+    int epfd;
+    int wake_fd;
+    server_session_t *sessions;
+    pthread_mutex_t lock;
+    int *pending;
+    int pending_count;
+    int pending_cap;
+};
+
+typedef struct {
+    int listen_fd;
+    int stop_fd;
+    int stop;
+    int telnet;
+    int tcp;
+    int max_sessions;
+    int sessions;
+    int n_workers;
+    server_worker_t *workers;
+    pthread_t acceptor;
+    char unix_path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+} server_t;
+
+static server_t srv = {.listen_fd = -1, .stop_fd = -1};
+
+static uint32_t server_get_tick(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static uint32_t server_get_cycles(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec);
+}
+
+static void wake_fd_signal(int fd) {
+    uint64_t one = 1;
+    ssize_t ret = write(fd, &one, sizeof(one));
+    (void) ret;
+}
+
+static void wake_fd_drain(int fd) {
+    uint64_t v;
+    ssize_t ret = read(fd, &v, sizeof(v));
+    (void) ret;
+}
+
+/* non-blocking send of the queued output, -1 if the peer is gone */
+static int session_flush_out(server_session_t *s) {
+    uint32_t done = 0;
+    while (done < s->out_len) {
+        ssize_t n = send(s->fd, s->out + done, s->out_len - done, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        done += (uint32_t) n;
+    }
+    memmove(s->out, s->out + done, s->out_len - done);
+    s->out_len -= done;
+    return 0;
+}
+
+/*
+ * A session with queued output is not run again until EPOLLOUT has drained
+ * it, so a slow client holds back only its own commands.
+ */
+static int session_runnable(const server_session_t *s) {
+    return s->out_len == 0;
+}
+
+static void session_send(server_session_t *s, const char *data, uint32_t len) {
+    if (s->dead) return;
+
+    if (s->out_len == 0) {
+        ssize_t n = send(s->fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                s->dead = 1;
+                return;
+            }
+            n = 0;
+        }
+        data += n;
+        len -= (uint32_t) n;
+    }
+
+    if (len > sizeof(s->out) - s->out_len && s->out_len > 0 && session_flush_out(s) < 0) {
+        s->dead = 1;
+        return;
+    }
+    // a running command cannot wait for the client without stalling the worker, a client that lags this far is dropped
+    if (len > sizeof(s->out) - s->out_len) {
+        s->dead = 1;
+        return;
+    }
+    memcpy(s->out + s->out_len, data, len);
+    s->out_len += len;
+}
+
+static void session_shell_write(const char *str, uint16_t len, void *priv) {
+    session_send((server_session_t *) priv, str, len);
+}
+
+static void telnet_reply(server_session_t *s, uint8_t cmd, uint8_t opt) {
+    const char msg[3] = {(char) TELNET_IAC, (char) cmd, (char) opt};
+    session_send(s, msg, sizeof(msg));
+}
+
+/* we offer WILL ECHO and WILL SGA, everything else is refused */
+static void telnet_option(server_session_t *s, uint8_t cmd, uint8_t opt) {
+    switch (cmd) {
+        case TELNET_DO:
+            if (opt == TELNET_OPT_ECHO) {
+                ctshell_set_echo(&s->ctx, 1);
+            } else if (opt != TELNET_OPT_SGA) {
+                telnet_reply(s, TELNET_WONT, opt);
+            }
+            break;
+        case TELNET_DONT:
+            // the client echoes locally
+            if (opt == TELNET_OPT_ECHO) ctshell_set_echo(&s->ctx, 0);
+            break;
+        case TELNET_WILL:
+            telnet_reply(s, opt == TELNET_OPT_SGA ? TELNET_DO : TELNET_DONT, opt);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Strips telnet commands and folds CR LF / CR NUL into CR, in place.
+ * Returns the number of bytes left for the shell.
+ */
+static int session_filter(server_session_t *s, char *buf, int len) {
+    int out = 0;
+#ifdef CONFIG_CTSHELL_USE_RPC
+    // after `rpc` the packets are binary, they pass untouched until RPC mode ends
+    if (s->ctx.rpc_mode) return len;
+#endif
+    for (int i = 0; i < len; i++) {
+        uint8_t c = (uint8_t) buf[i];
+        switch (s->tn_state) {
+            case TN_CR:
+                s->tn_state = TN_DATA;
+                if (c == '\n' || c == '\0') break;
+                /* fall through */
+            case TN_DATA:
+                if (c == TELNET_IAC && srv.telnet) {
+                    s->tn_state = TN_IAC;
+                } else {
+                    if (c == '\r') s->tn_state = TN_CR;
+                    buf[out++] = (char) c;
+                }
+                break;
+            case TN_IAC:
+                s->tn_state = TN_DATA;
+                if (c >= TELNET_WILL && c <= TELNET_DONT) {
+                    s->tn_cmd = c;
+                    s->tn_state = TN_OPT;
+                } else if (c == TELNET_SB) {
+                    s->tn_state = TN_SB;
+                } else if (c == TELNET_IP) {
+                    buf[out++] = CTSHELL_KEY_CTRL_C;
+                }
+                break;
+            case TN_OPT:
+                s->tn_state = TN_DATA;
+                telnet_option(s, s->tn_cmd, c);
+                break;
+            case TN_SB:
+                if (c == TELNET_IAC) s->tn_state = TN_SB_IAC;
+                break;
+            case TN_SB_IAC:
+                s->tn_state = (c == TELNET_SE) ? TN_DATA : TN_SB;
+                break;
+            default:
+                s->tn_state = TN_DATA;
+                break;
+        }
+    }
+    return out;
+}
+
+/*
+ * keeps what the FIFO did not take, in order, as the terminal port does.
+ * The socket is only read while the stash is empty and a read is never
+ * longer than the stash, so nothing is dropped.
+ */
+static void session_stash(server_session_t *s, const char *buf, int len) {
+    int interrupt = 1;
+#ifdef CONFIG_CTSHELL_USE_RPC
+    // a packet byte, it must not overtake the stash
+    interrupt = !s->ctx.rpc_mode;
+#endif
+    for (int i = 0; i < len; i++) {
+        if (buf[i] == CTSHELL_KEY_CTRL_C && interrupt) {
+            ctshell_input(&s->ctx, buf[i]);
+        } else if (s->pend_len < sizeof(s->pend)) {
+            s->pend[s->pend_len++] = buf[i];
+        }
+    }
+}
+
+/* moves stashed input into the FIFO, running the shell on it when `run` until output backs up */
+static void session_feed_pending(server_session_t *s, int run) {
+    while (s->pend_len > 0 && !s->dead && (!run || session_runnable(s))) {
+        uint16_t n = ctshell_input_buf(&s->ctx, s->pend, s->pend_len);
+        if (n == 0) return;
+        s->pend_len -= n;
+        memmove(s->pend, s->pend + n, s->pend_len);
+        if (run) ctshell_poll(&s->ctx);
+    }
+}
+
+/* queues filtered input behind the stash without running the shell, safe from inside a command */
+static void session_queue(server_session_t *s, const char *buf, int len) {
+    int off = 0;
+    session_feed_pending(s, 0);
+    if (s->pend_len == 0) off = ctshell_input_buf(&s->ctx, buf, (uint16_t) len);
+    session_stash(s, buf + off, len - off);
+}
+
+static void session_read(server_session_t *s) {
+    char buf[SERVER_READ_CHUNK];
+
+    session_feed_pending(s, 1);
+    while (s->pend_len == 0 && !s->dead && session_runnable(s)) {
+        ssize_t n = recv(s->fd, buf, sizeof(buf), 0);
+        if (n == 0) {
+            s->dead = 1;
+            return;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) s->dead = 1;
+            return;
+        }
+
+        // the rest is stashed before anything runs, input read by a command sleeping in session_idle queues up behind it
+        session_queue(s, buf, session_filter(s, buf, (int) n));
+        ctshell_poll(&s->ctx);
+        // an asynchronous command holds the FIFO, the rest waits for it to end
+        session_feed_pending(s, 1);
+        if ((size_t) n < sizeof(buf)) return;
+    }
+}
+
+/* io.idle: a delaying command keeps its worker, but still sees Ctrl+C unless input is stashed */
+static void session_idle(uint32_t ms, void *priv) {
+    server_session_t *s = (server_session_t *) priv;
+    struct pollfd pfd = {.fd = s->fd, .events = POLLIN};
+    char buf[SERVER_READ_CHUNK];
+
+    session_feed_pending(s, 0);
+    if (s->dead || s->pend_len > 0) {
+        poll(NULL, 0, ms > INT_MAX ? INT_MAX : (int) ms);
+        return;
+    }
+    if (poll(&pfd, 1, ms > INT_MAX ? INT_MAX : (int) ms) <= 0) return;
+
+    ssize_t n = recv(s->fd, buf, sizeof(buf), 0);
+    if (n > 0) {
+        int len = session_filter(s, buf, (int) n);
+        if (len > 0) session_queue(s, buf, len);
+    } else if (n == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        s->dead = 1;
+    }
+}
+
+/* arm EPOLLIN only while the stash is empty and the session runnable, EPOLLOUT only while output is queued */
+static void session_update_events(server_session_t *s) {
+    uint8_t want_in = s->pend_len == 0 && session_runnable(s);
+    uint8_t want_out = s->out_len > 0;
+    if (want_in == s->want_in && want_out == s->want_out) return;
+
+    struct epoll_event ev = {.events = (want_in ? EPOLLIN : 0) | EPOLLRDHUP | (want_out ? EPOLLOUT : 0),
+                             .data.ptr = s};
+    epoll_ctl(s->worker->epfd, EPOLL_CTL_MOD, s->fd, &ev);
+    s->want_in = want_in;
+    s->want_out = want_out;
+}
+
+static void session_close(server_session_t *s) {
+    server_worker_t *w = s->worker;
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    if (s->prev) s->prev->next = s->next;
+    else w->sessions = s->next;
+    if (s->next) s->next->prev = s->prev;
+    // the newest session is the process-wide fallback shell
+    ctshell_deinit(&s->ctx);
+    free(s);
+    __atomic_sub_fetch(&srv.sessions, 1, __ATOMIC_RELAXED);
+}
+
+static void session_open(server_worker_t *w, int fd) {
+    size_t size = (sizeof(server_session_t) + CONFIG_CTSHELL_CACHE_LINE_SIZE - 1) &
+                  ~(size_t) (CONFIG_CTSHELL_CACHE_LINE_SIZE - 1);
+    server_session_t *s = aligned_alloc(CONFIG_CTSHELL_CACHE_LINE_SIZE, size);
+    if (!s) {
+        close(fd);
+        __atomic_sub_fetch(&srv.sessions, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    s->worker = w;
+    s->want_in = 1;
+
+    if (srv.telnet) {
+        const char offer[] = {(char) TELNET_IAC, (char) TELNET_WILL, TELNET_OPT_ECHO,
+                              (char) TELNET_IAC, (char) TELNET_WILL, TELNET_OPT_SGA};
+        session_send(s, offer, sizeof(offer));
+    }
+
+    ctshell_io_t io = {
+            .write = session_shell_write,
+            .get_tick = server_get_tick,
+            .get_cycles = server_get_cycles,
+            .cycles_hz = 1000000000u,
+            .idle = session_idle,
+    };
+    ctshell_init(&s->ctx, io, s);
+    // raw clients echo locally, telnet clients switch it back on with DO ECHO
+    ctshell_set_echo(&s->ctx, srv.telnet);
+
+    s->next = w->sessions;
+    if (w->sessions) w->sessions->prev = s;
+    w->sessions = s;
+
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP, .data.ptr = s};
+    if (s->dead || epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        session_close(s);
+        return;
+    }
+    session_update_events(s);
+}
+
+static void worker_adopt(server_worker_t *w) {
+    for (;;) {
+        int fd;
+        pthread_mutex_lock(&w->lock);
+        if (w->pending_count == 0) {
+            pthread_mutex_unlock(&w->lock);
+            return;
+        }
+        fd = w->pending[--w->pending_count];
+        pthread_mutex_unlock(&w->lock);
+        session_open(w, fd);
+    }
+}
+
+#ifdef CONFIG_CTSHELL_USE_ASYNC
+/* epoll timeout until the earliest asynchronous command wants to run again */
+static int worker_timeout(server_worker_t *w) {
+    uint32_t ms = CTSHELL_WAIT_FOREVER;
+    for (server_session_t *s = w->sessions; s && ms > 0; s = s->next) {
+        // woken by EPOLLOUT instead
+        if (!session_runnable(s)) continue;
+        uint32_t t = ctshell_next_timeout(&s->ctx);
+        if (t < ms) ms = t;
+    }
+    if (ms == CTSHELL_WAIT_FOREVER) return -1;
+    return ms > INT_MAX ? INT_MAX : (int) ms;
+}
+
+static void worker_run_due(server_worker_t *w) {
+    server_session_t *next;
+    for (server_session_t *s = w->sessions; s; s = next) {
+        next = s->next;
+        if (!session_runnable(s) || ctshell_next_timeout(&s->ctx) > 0) continue;
+        ctshell_poll(&s->ctx);
+        // typeahead stashed while a foreground job held the FIFO
+        session_feed_pending(s, 1);
+        if (s->dead) {
+            session_close(s);
+        } else {
+            session_update_events(s);
+        }
+    }
+}
+#else
+#define worker_timeout(w) (-1)
+#define worker_run_due(w) ((void) 0)
+#endif
+
+static void *worker_main(void *arg) {
+    server_worker_t *w = (server_worker_t *) arg;
+    struct epoll_event evs[SERVER_EVENTS];
+
+    while (!__atomic_load_n(&srv.stop, __ATOMIC_ACQUIRE)) {
+        int n = epoll_wait(w->epfd, evs, SERVER_EVENTS, worker_timeout(w));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            server_session_t *s = (server_session_t *) evs[i].data.ptr;
+            if (!s) {
+                wake_fd_drain(w->wake_fd);
+                worker_adopt(w);
+                continue;
+            }
+            uint32_t events = evs[i].events;
+            int held = !session_runnable(s);
+            if ((events & EPOLLOUT) && session_flush_out(s) < 0) s->dead = 1;
+            // input that arrived or was stashed while the output was held back
+            if (((events & EPOLLIN) || held) && !s->dead && session_runnable(s)) session_read(s);
+            if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) s->dead = 1;
+
+            if (s->dead) {
+                session_close(s);
+            } else {
+                session_update_events(s);
+            }
+        }
+        worker_run_due(w);
+    }
+
+    while (w->sessions) {
+        session_close(w->sessions);
+    }
+    return NULL;
+}
+
+static void *acceptor_main(void *arg) {
+    (void) arg;
+    struct pollfd fds[2] = {
+            {.fd = srv.listen_fd, .events = POLLIN},
+            {.fd = srv.stop_fd, .events = POLLIN},
+    };
+    int next_worker = 0;
+
+    while (!__atomic_load_n(&srv.stop, __ATOMIC_ACQUIRE)) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (!(fds[0].revents & POLLIN)) continue;
+
+        int fd = accept4(srv.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) continue;
+
+        if (__atomic_add_fetch(&srv.sessions, 1, __ATOMIC_RELAXED) > srv.max_sessions) {
+            __atomic_sub_fetch(&srv.sessions, 1, __ATOMIC_RELAXED);
+            close(fd);
+            continue;
+        }
+        if (srv.tcp) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        server_worker_t *w = &srv.workers[next_worker];
+        next_worker = (next_worker + 1) % srv.n_workers;
+
+        pthread_mutex_lock(&w->lock);
+        if (w->pending_count == w->pending_cap) {
+            int cap = w->pending_cap ? w->pending_cap * 2 : 16;
+            int *p = realloc(w->pending, cap * sizeof(int));
+            if (!p) {
+                pthread_mutex_unlock(&w->lock);
+                __atomic_sub_fetch(&srv.sessions, 1, __ATOMIC_RELAXED);
+                close(fd);
+                continue;
+            }
+            w->pending = p;
+            w->pending_cap = cap;
+        }
+        w->pending[w->pending_count++] = fd;
+        pthread_mutex_unlock(&w->lock);
+        wake_fd_signal(w->wake_fd);
+    }
+    return NULL;
+}
+
+static int server_listen(const ctshell_posix_server_cfg_t *cfg) {
+    int fd;
+
+    if (cfg->unix_path) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        if (strlen(cfg->unix_path) >= sizeof(addr.sun_path)) return -1;
+        strcpy(addr.sun_path, cfg->unix_path);
+        strcpy(srv.unix_path, cfg->unix_path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        unlink(cfg->unix_path);
+        if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_in addr = {
+                .sin_family = AF_INET,
+                .sin_port = htons(cfg->tcp_port),
+                .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        int one = 1;
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+        srv.tcp = 1;
+    }
+
+    if (listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void server_cleanup(void) {
+    for (int i = 0; i < srv.n_workers; i++) {
+        server_worker_t *w = &srv.workers[i];
+        for (int j = 0; j < w->pending_count; j++) {
+            close(w->pending[j]);
+        }
+        free(w->pending);
+        if (w->epfd >= 0) close(w->epfd);
+        if (w->wake_fd >= 0) close(w->wake_fd);
+        pthread_mutex_destroy(&w->lock);
+    }
+    free(srv.workers);
+    if (srv.stop_fd >= 0) close(srv.stop_fd);
+    if (srv.listen_fd >= 0) close(srv.listen_fd);
+    if (srv.unix_path[0]) unlink(srv.unix_path);
+    memset(&srv, 0, sizeof(srv));
+    srv.listen_fd = -1;
+    srv.stop_fd = -1;
+}
+
+int ctshell_posix_server_start(const ctshell_posix_server_cfg_t *cfg) {
+    if (cfg == NULL || srv.workers != NULL) {
+        return -1;
+    }
+
+    srv.stop = 0;
+    srv.telnet = cfg->telnet;
+    srv.max_sessions = cfg->max_sessions > 0 ? cfg->max_sessions : CONFIG_CTSHELL_POSIX_SERVER_MAX_SESSIONS;
+    srv.n_workers = cfg->workers > 0 ? cfg->workers : CONFIG_CTSHELL_POSIX_SERVER_WORKERS;
+
+    srv.listen_fd = server_listen(cfg);
+    if (srv.listen_fd < 0) {
+        server_cleanup();
+        return -2;
+    }
+    srv.stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    srv.workers = calloc(srv.n_workers, sizeof(server_worker_t));
+    if (srv.stop_fd < 0 || srv.workers == NULL) {
+        server_cleanup();
+        return -3;
+    }
+
+    for (int i = 0; i < srv.n_workers; i++) {
+        server_worker_t *w = &srv.workers[i];
+        pthread_mutex_init(&w->lock, NULL);
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        w->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+        if (w->epfd < 0 || w->wake_fd < 0 || epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->wake_fd, &ev) < 0 ||
+            pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            srv.n_workers = i + 1;
+            ctshell_posix_server_stop();
+            return -4;
+        }
+    }
+
+    if (pthread_create(&srv.acceptor, NULL, acceptor_main, NULL) != 0) {
+        ctshell_posix_server_stop();
+        return -5;
+    }
+    return 0;
+}
+
+void ctshell_posix_server_stop(void) {
+    if (srv.workers == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&srv.stop, 1, __ATOMIC_RELEASE);
+    if (srv.acceptor) {
+        wake_fd_signal(srv.stop_fd);
+        pthread_join(srv.acceptor, NULL);
+    }
+    for (int i = 0; i < srv.n_workers; i++) {
+        server_worker_t *w = &srv.workers[i];
+        if (w->thread) {
+            wake_fd_signal(w->wake_fd);
+            pthread_join(w->thread, NULL);
+        }
+    }
+    server_cleanup();
+}
+
+int ctshell_posix_server_sessions(void) {
+    return __atomic_load_n(&srv.sessions, __ATOMIC_RELAXED);
+}
+
+#endif
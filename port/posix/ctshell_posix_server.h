@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include "ctshell.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CONFIG_CTSHELL_POSIX_SERVER_WORKERS
+#define CONFIG_CTSHELL_POSIX_SERVER_WORKERS      4
+#endif
+
+#ifndef CONFIG_CTSHELL_POSIX_SERVER_MAX_SESSIONS
+#define CONFIG_CTSHELL_POSIX_SERVER_MAX_SESSIONS 1024
+#endif
+
+#ifndef CONFIG_CTSHELL_POSIX_SERVER_OUT_BUF
+#define CONFIG_CTSHELL_POSIX_SERVER_OUT_BUF      8192
+#endif
+
+typedef struct {
+    const char *unix_path;  // listen on this Unix-domain socket, or NULL
+    uint16_t tcp_port;      // otherwise listen on 127.0.0.1:tcp_port
+    int workers;            // worker threads, 0 for the default
+    int max_sessions;       // 0 for the default
+    int telnet;             // negotiate echo with telnet clients
+} ctshell_posix_server_cfg_t;
+
+int ctshell_posix_server_start(const ctshell_posix_server_cfg_t *cfg);
+void ctshell_posix_server_stop(void);
+int ctshell_posix_server_sessions(void);
+
+#ifdef __cplusplus
+}
+#endif
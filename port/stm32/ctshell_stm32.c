@@ -19,6 +19,20 @@ static void stm32_shell_write(const char *str, uint16_t len, void *p) {
     HAL_UART_Transmit(d->huart, (uint8_t *) str, len, 100);
 }
 
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+/* DWT cycle counter, not present on Cortex-M0/M0+ */
+static uint32_t stm32_get_cycles(void) {
+    return DWT->CYCCNT;
+}
+#endif
+
+/* any interrupt ends the sleep, SysTick bounds it to one tick */
+static void stm32_idle(uint32_t ms, void *p) {
+    (void) ms;
+    (void) p;
+    __WFI();
+}
+
 void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
     if (huart == priv.huart) {
         ctshell_input(g_ctx, rx_byte);
@@ -34,7 +48,14 @@ void ctshell_stm32_init(ctshell_ctx_t *ctx, UART_HandleTypeDef *huart) {
     ctshell_io_t io = {
             .write = stm32_shell_write,
             .get_tick = HAL_GetTick,
+            .idle = stm32_idle,
     };
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    io.get_cycles = stm32_get_cycles;
+    io.cycles_hz = SystemCoreClock;
+#endif
 
     ctshell_init(ctx, io, &priv);
     HAL_UART_Receive_IT(huart, &rx_byte, 1);
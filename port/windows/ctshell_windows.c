@@ -32,6 +32,21 @@ static uint32_t windows_get_tick(void) {
     return GetTickCount();
 }
 
+static uint32_t windows_get_cycles(void) {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (uint32_t) now.QuadPart;
+}
+
+/* wakes on console input, which is queued right away so Ctrl+C reaches ctshell_delay */
+static void windows_idle(uint32_t ms, void *p) {
+    UNREFERENCED_PARAMETER(p);
+    DWORD timeout = ms == CTSHELL_WAIT_FOREVER ? INFINITE : (DWORD) ms;
+    if (WaitForSingleObject(priv.hStdin, timeout) == WAIT_OBJECT_0) {
+        ctshell_windows_process_input(g_ctx);
+    }
+}
+
 int ctshell_windows_init(ctshell_ctx_t *ctx) {
     if (ctx == NULL) {
         return -1;
@@ -49,9 +64,14 @@ int ctshell_windows_init(ctshell_ctx_t *ctx) {
     if (!SetConsoleMode(priv.hStdin, dwNewMode)) {
         return -4;
     }
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
     ctshell_io_t io = {
             .write = windows_shell_write,
             .get_tick = windows_get_tick,
+            .get_cycles = windows_get_cycles,
+            .cycles_hz = (uint32_t) freq.QuadPart,
+            .idle = windows_idle,
     };
     ctshell_init(ctx, io, &priv);
 
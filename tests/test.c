@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "test.h"
+
+#include <string.h>
+#include <time.h>
+
+#define TEST_OUT_SIZE 65536
+
+int test_failures;
+
+static char out_buf[TEST_OUT_SIZE + 1];
+static size_t out_len;
+
+static void test_write(const char *str, uint16_t len, void *priv) {
+    (void) priv;
+    if (len > TEST_OUT_SIZE - out_len) len = (uint16_t) (TEST_OUT_SIZE - out_len);
+    memcpy(&out_buf[out_len], str, len);
+    out_len += len;
+    out_buf[out_len] = '\0';
+}
+
+static uint32_t test_get_tick(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) (ts.tv_sec * 1000u + ts.tv_nsec / 1000000u);
+}
+
+void test_setup(ctshell_ctx_t *ctx) {
+    ctshell_io_t io = {
+            .write = test_write,
+            .get_tick = test_get_tick,
+    };
+    ctshell_init(ctx, io, NULL);
+    test_clear();
+}
+
+const char *test_output(void) {
+    return out_buf;
+}
+
+size_t test_output_len(void) {
+    return out_len;
+}
+
+void test_clear(void) {
+    out_len = 0;
+    out_buf[0] = '\0';
+}
+
+void test_feed(ctshell_ctx_t *ctx, const char *s) {
+    ctshell_input_buf(ctx, s, (uint16_t) strlen(s));
+    ctshell_poll(ctx);
+}
+
+int test_result(const char *name) {
+    if (test_failures) {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, test_failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include "ctshell.h"
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int test_failures;
+
+/* records a failure and carries on, main returns test_result() */
+#define TEST_CHECK(cond)                                                              \
+    do {                                                                              \
+        if (!(cond)) {                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);  \
+            test_failures++;                                                          \
+        }                                                                             \
+    } while (0)
+
+/*
+ * Initializes `ctx` with an io that appends all output to a buffer, read
+ * back with test_output and emptied with test_clear.
+ */
+void test_setup(ctshell_ctx_t *ctx);
+
+/* output since the last test_clear, NUL-terminated */
+const char *test_output(void);
+size_t test_output_len(void);
+void test_clear(void);
+
+/* feeds a whole string and polls once */
+void test_feed(ctshell_ctx_t *ctx, const char *s);
+
+int test_result(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * The input FIFO with a producer thread and the shell polling on another:
+ * numbered lines go through a small ring many times over, and through the
+ * wraparound of its 32-bit indices, and must run in order with none lost.
+ */
+#include "test.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#define LINES 50000
+
+static ctshell_ctx_t ctx;
+static volatile int producer_done;
+static unsigned expected;
+static unsigned bad;
+
+static int cmd_s(int argc, char *argv[]) {
+    if (argc != 2 || strtoul(argv[1], NULL, 10) != expected) {
+        if (bad++ < 5) fprintf(stderr, "line %u: got '%s'\n", expected, argc > 1 ? argv[1] : "");
+        if (argc == 2) expected = (unsigned) strtoul(argv[1], NULL, 10);
+    }
+    expected++;
+    return 0;
+}
+CTSHELL_EXPORT_CMD(s, cmd_s, "Check a sequence number", CTSHELL_ATTR_NONE);
+
+static void *producer(void *arg) {
+    (void) arg;
+    char line[16];
+    for (unsigned n = 0; n < LINES; n++) {
+        int len = snprintf(line, sizeof(line), "s %u\r", n);
+        int done = 0;
+        while (done < len) {
+            uint16_t pushed = ctshell_input_buf(&ctx, line + done, (uint16_t) (len - done));
+            if (!pushed) sched_yield();
+            done += pushed;
+        }
+    }
+    __atomic_store_n(&producer_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int main(void) {
+    pthread_t tid;
+
+    test_setup(&ctx);
+    ctshell_set_echo(&ctx, 0);
+    // both indices cross 2^32 early in the run
+    ctx.fifo_head = ctx.fifo_tail = 0xFFFFF000u;
+
+    TEST_CHECK(pthread_create(&tid, NULL, producer, NULL) == 0);
+    for (;;) {
+        int done = __atomic_load_n(&producer_done, __ATOMIC_ACQUIRE);
+        test_clear();
+        ctshell_poll(&ctx);
+        if (ctshell_next_timeout(&ctx) != 0) {
+            if (done) break;
+            sched_yield();
+        }
+    }
+    pthread_join(tid, NULL);
+
+    TEST_CHECK(bad == 0);
+    TEST_CHECK(expected == LINES);
+    TEST_CHECK(ctx.fifo_head == ctx.fifo_tail && ctx.fifo_head < 0xFFFFF000u);
+    return test_result("test_fifo");
+}
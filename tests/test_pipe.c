@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * The readers of a pipeline take job slots but are not jobs: `jobs`, `fg`
+ * and `kill` run inside the pipeline do not see them. grep decides on
+ * whole lines, also those longer than the pipe.
+ */
+#include "test.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static ctshell_ctx_t ctx;
+
+static int cmd_wide(int argc, char *argv[]) {
+    int w = argc > 1 ? atoi(argv[1]) : 0;
+    ctshell_printf("%0*d ERR\r\n", w, 0);
+    ctshell_printf("%0*d ok\r\n", w, 0);
+    return 0;
+}
+CTSHELL_EXPORT_CMD(wide, cmd_wide, "Print two zero-padded lines", CTSHELL_ATTR_NONE);
+
+int main(void) {
+    test_setup(&ctx);
+
+    test_feed(&ctx, "echo a b | grep a\r");
+    TEST_CHECK(strstr(test_output(), "\r\na b\r\n") != NULL);
+
+    // grep would match its own "Running grep Running" line
+    test_clear();
+    test_feed(&ctx, "jobs | grep Running\r");
+    TEST_CHECK(strstr(test_output(), "] Running") == NULL);
+
+    test_clear();
+    test_feed(&ctx, "kill | grep -v zzz\r");
+    TEST_CHECK(strstr(test_output(), "kill: no current job") != NULL);
+
+    test_clear();
+    test_feed(&ctx, "kill %1 | grep -v zzz\r");
+    TEST_CHECK(strstr(test_output(), "kill: %1: no such job") != NULL);
+
+    test_clear();
+    test_feed(&ctx, "fg | grep -v zzz\r");
+    TEST_CHECK(strstr(test_output(), "fg: no current job") != NULL);
+
+    // the pattern comes after the first pipe-sized piece of the line
+    char zeros[101];
+    memset(zeros, '0', 100);
+    zeros[100] = '\0';
+    test_clear();
+    test_feed(&ctx, "wide 100 | grep ERR\r");
+    TEST_CHECK(strstr(test_output(), "ERR\r\n") != NULL);
+    TEST_CHECK(strstr(test_output(), zeros) != NULL);
+    TEST_CHECK(strstr(test_output(), " ok") == NULL);
+
+    test_clear();
+    test_feed(&ctx, "wide 100 | grep -v ERR\r");
+    TEST_CHECK(strstr(test_output(), "0 ERR") == NULL);
+    TEST_CHECK(strstr(test_output(), " ok\r\n") != NULL);
+
+    // a pattern split across two pieces
+    test_clear();
+    test_feed(&ctx, "wide 62 | grep \"0 E\"\r");
+    TEST_CHECK(strstr(test_output(), "0 ERR\r\n") != NULL);
+    TEST_CHECK(strstr(test_output(), " ok") == NULL);
+
+    return test_result("test_pipe");
+}
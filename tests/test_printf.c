@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * ctshell_printf conversions against the C library's, length modifiers in
+ * particular.
+ */
+#include "test.h"
+
+#include <string.h>
+
+static ctshell_ctx_t ctx;
+
+#define CHECK_FMT(fmt, ...)                                                        \
+    do {                                                                           \
+        char want[64];                                                             \
+        snprintf(want, sizeof(want), fmt, __VA_ARGS__);                            \
+        test_clear();                                                              \
+        ctshell_ctx_printf(&ctx, fmt, __VA_ARGS__);                                \
+        ctshell_flush(&ctx);                                                       \
+        if (strcmp(test_output(), want) != 0) {                                    \
+            fprintf(stderr, "'%s': '%s', want '%s'\n", fmt, test_output(), want);  \
+        }                                                                          \
+        TEST_CHECK(strcmp(test_output(), want) == 0);                              \
+    } while (0)
+
+int main(void) {
+    test_setup(&ctx);
+
+    // h and hh narrow the promoted int back to short and char
+    CHECK_FMT("%hd %hi", 70000, -70000);
+    CHECK_FMT("%hu %hx %ho", 70000, 0x12345, 0x12345);
+    CHECK_FMT("%hhd %hhi", 200, -200);
+    CHECK_FMT("%hhu %hhx %hhX", 300, 0x1ff, -1);
+    CHECK_FMT("%hd %hhd", (short) -5, (signed char) -5);
+
+    CHECK_FMT("%d %ld %lld %zu", -1, -2L, -3LL, (size_t) 4);
+    CHECK_FMT("%5d|%-5d|%05d|%+d", 42, 42, 42, 42);
+    CHECK_FMT("%#x %#o %.3d", 255, 8, 7);
+
+    return test_result("test_printf");
+}
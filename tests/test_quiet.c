@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Quiet mode puts every end marker at the start of a line, also after output
+ * without a line break, and the CR LF that ends `quiet off` is one Enter.
+ */
+#include "test.h"
+
+#include <string.h>
+
+static ctshell_ctx_t ctx;
+
+static int cmd_part(int argc, char *argv[]) {
+    CTSHELL_UNUSED_PARAM(argc);
+    CTSHELL_UNUSED_PARAM(argv);
+    ctshell_printf("x");
+    return 3;
+}
+CTSHELL_EXPORT_CMD(part, cmd_part, "Print without a line break", CTSHELL_ATTR_NONE);
+
+static int count(const char *s) {
+    int n = 0;
+    for (const char *p = test_output(); (p = strstr(p, s)) != NULL; p += strlen(s)) n++;
+    return n;
+}
+
+int main(void) {
+    test_setup(&ctx);
+
+    test_feed(&ctx, "quiet on\r\n");
+    TEST_CHECK(ctx.quiet);
+
+    test_clear();
+    test_feed(&ctx, "nosuch\r\n");
+    TEST_CHECK(strstr(test_output(), "nosuch: command not found\r\n\x03" "1 -1\r\n") != NULL);
+
+    test_clear();
+    test_feed(&ctx, "part\r\n");
+    TEST_CHECK(strstr(test_output(), "x\r\n\x03" "2 3\r\n") != NULL);
+
+    // output that ends its line gets no blank line
+    test_clear();
+    test_feed(&ctx, "echo hi\r\n");
+    TEST_CHECK(strstr(test_output(), "hi\r\n\x03" "3 0\r\n") != NULL);
+
+    test_clear();
+    test_feed(&ctx, "quiet off\r\n");
+    TEST_CHECK(!ctx.quiet);
+    TEST_CHECK(count(CONFIG_CTSHELL_PROMPT) == 1);
+
+    // a later LF is an Enter again
+    test_clear();
+    test_feed(&ctx, "\n");
+    TEST_CHECK(count(CONFIG_CTSHELL_PROMPT) == 1);
+
+    return test_result("test_quiet");
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Output redirection to a file, from the command line and around `sh`,
+ * whose script lines keep writing to the file opened for the script.
+ */
+#include "test.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ROOT "test_redirect.d"
+
+static ctshell_ctx_t ctx;
+
+static void host_path(const char *path, char *out, size_t size) {
+    snprintf(out, size, ROOT "%s", path);
+}
+
+static int fs_open(const char *path, int flags) {
+    char p[CONFIG_CTSHELL_FS_PATH_MAX + 32];
+    host_path(path, p, sizeof(p));
+    if (flags == 0) return open(p, O_RDONLY);
+    return open(p, O_WRONLY | O_CREAT | (flags & CTSHELL_O_APPEND ? O_APPEND : O_TRUNC), 0644);
+}
+
+static int fs_close(int fd) {
+    return close(fd);
+}
+
+static int fs_read(int fd, void *buf, uint32_t count) {
+    return (int) read(fd, buf, count);
+}
+
+static int fs_write(int fd, const void *buf, uint32_t count) {
+    return (int) write(fd, buf, count);
+}
+
+static int fs_lseek(int fd, long offset, int whence) {
+    return (int) lseek(fd, offset, whence);
+}
+
+static const ctshell_fs_drv_t drv = {
+        .open = fs_open,
+        .close = fs_close,
+        .read = fs_read,
+        .write = fs_write,
+        .lseek = fs_lseek,
+};
+
+static void write_file(const char *path, const char *text) {
+    char p[CONFIG_CTSHELL_FS_PATH_MAX + 32];
+    host_path(path, p, sizeof(p));
+    FILE *f = fopen(p, "w");
+    if (!f) return;
+    fputs(text, f);
+    fclose(f);
+}
+
+static const char *read_file(const char *path) {
+    static char buf[4096];
+    char p[CONFIG_CTSHELL_FS_PATH_MAX + 32];
+    host_path(path, p, sizeof(p));
+    buf[0] = '\0';
+    FILE *f = fopen(p, "r");
+    if (!f) return buf;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    return buf;
+}
+
+static int cmd_dump(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 1;
+    for (int i = 0; i < n; i++) {
+        ctshell_printf("reg %d\r\n", i);
+    }
+    return 0;
+}
+CTSHELL_EXPORT_CMD(dump, cmd_dump, "Print registers", CTSHELL_ATTR_NONE);
+
+static int cmd_abort(int argc, char *argv[]) {
+    CTSHELL_UNUSED_PARAM(argc);
+    CTSHELL_UNUSED_PARAM(argv);
+    ctshell_ctx_t *c = ctshell_current_ctx();
+    ctshell_printf("partial\r\n");
+    c->sigint = 1;
+    ctshell_check_abort(c);
+    return 0;
+}
+CTSHELL_EXPORT_CMD(abort, cmd_abort, "Abort itself", CTSHELL_ATTR_NONE);
+
+int main(void) {
+    mkdir(ROOT, 0755);
+    test_setup(&ctx);
+    ctshell_fs_init(&ctx, &drv);
+
+    test_clear();
+    test_feed(&ctx, "dump 2 > /a.txt\r");
+    TEST_CHECK(strcmp(read_file("/a.txt"), "reg 0\r\nreg 1\r\n") == 0);
+    TEST_CHECK(strstr(test_output(), "reg") == NULL);
+
+    test_feed(&ctx, "dump 1 >> /a.txt\r");
+    TEST_CHECK(strcmp(read_file("/a.txt"), "reg 0\r\nreg 1\r\nreg 0\r\n") == 0);
+
+    // every line of the script writes to the file opened for `sh`
+    write_file("/s.sh", "dump 2\ndump 3\n");
+    test_clear();
+    test_feed(&ctx, "sh /s.sh > /out.txt\r");
+    TEST_CHECK(strcmp(read_file("/out.txt"), "reg 0\r\nreg 1\r\nreg 0\r\nreg 1\r\nreg 2\r\n") == 0);
+    TEST_CHECK(strstr(test_output(), "reg") == NULL);
+
+    // a nested redirection is refused and an aborted line does not close the outer file
+    write_file("/t.sh", "dump 1\ndump 1 > /b.txt\nabort\ndump 2\n");
+    test_clear();
+    test_feed(&ctx, "sh /t.sh > /out.txt\r");
+    TEST_CHECK(strncmp(read_file("/out.txt"), "reg 0\r\n", 7) == 0);
+    TEST_CHECK(strstr(read_file("/out.txt"), "partial\r\nreg 0\r\nreg 1\r\n") != NULL);
+    TEST_CHECK(strstr(test_output(), "Command aborted") != NULL);
+    TEST_CHECK(strstr(test_output(), "reg") == NULL);
+    TEST_CHECK(read_file("/b.txt")[0] == '\0');
+
+    // the console is back once the line has ended
+    test_clear();
+    test_feed(&ctx, "dump 1\r");
+    TEST_CHECK(strstr(test_output(), "reg 0") != NULL);
+
+    return test_result("test_redirect");
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Entering RPC mode takes the `rpc` command, requests are answered with
+ * well-formed packets, and a link that does not speak RPC falls back to text
+ * on undecodable packets or an unfinished one.
+ */
+#include "test.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_PACKETS 64
+
+typedef struct {
+    uint8_t type;
+    uint16_t seq;
+    uint8_t data[CONFIG_CTSHELL_RPC_FRAME_SIZE];
+    int len;
+} packet_t;
+
+static ctshell_ctx_t ctx;
+static char frames[256];
+static int frames_len;
+static packet_t packets[MAX_PACKETS];
+static int n_packets;
+static int bad_packets;
+
+static uint16_t crc16(const uint8_t *p, int len) {
+    uint16_t crc = 0xFFFF;
+    while (len-- > 0) {
+        crc ^= (uint16_t) (*p++ << 8);
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (uint16_t) (crc << 1) ^ 0x1021 : (uint16_t) (crc << 1);
+        }
+    }
+    return crc;
+}
+
+/* appends a COBS encoded request to `frames`, delimiter included */
+static void add_request(uint8_t type, uint16_t seq, const void *payload, int len) {
+    uint8_t raw[64] = {type, (uint8_t) seq, (uint8_t) (seq >> 8)};
+    memcpy(&raw[3], payload, len);
+    len += 3;
+    uint16_t crc = crc16(raw, len);
+    raw[len++] = (uint8_t) crc;
+    raw[len++] = (uint8_t) (crc >> 8);
+
+    int code_at = frames_len++;
+    uint8_t code = 1;
+    for (int i = 0; i < len; i++) {
+        if (raw[i] != 0) {
+            frames[frames_len++] = (char) raw[i];
+            code++;
+        }
+        if (raw[i] == 0 || code == 0xFF) {
+            frames[code_at] = (char) code;
+            code_at = frames_len++;
+            code = 1;
+        }
+    }
+    frames[code_at] = (char) code;
+    frames[frames_len++] = 0;
+}
+
+/* decodes every packet in the output so far; those with a bad CRC or shape are only counted */
+static void decode_output(void) {
+    const uint8_t *p = (const uint8_t *) test_output();
+    size_t n = test_output_len();
+    size_t start = 0;
+
+    n_packets = 0;
+    bad_packets = 0;
+    for (size_t end = 0; end < n; end++) {
+        if (p[end] != 0) continue;
+        uint8_t raw[CONFIG_CTSHELL_RPC_FRAME_SIZE + 8];
+        int len = 0;
+        int ok = 1;
+        for (size_t i = start; i < end && ok;) {
+            uint8_t code = p[i++];
+            if (code == 0 || i + code - 1 > end || len + code > (int) sizeof(raw)) {
+                ok = 0;
+                break;
+            }
+            for (int k = 1; k < code; k++) raw[len++] = p[i++];
+            if (code != 0xFF && i < end) raw[len++] = 0;
+        }
+        start = end + 1;
+        if (!ok || len < 5 || n_packets == MAX_PACKETS ||
+            crc16(raw, len - 2) != (uint16_t) (raw[len - 2] | raw[len - 1] << 8)) {
+            bad_packets++;
+            continue;
+        }
+        packet_t *pk = &packets[n_packets++];
+        pk->type = raw[0];
+        pk->seq = (uint16_t) (raw[1] | raw[2] << 8);
+        pk->len = len - 5;
+        memcpy(pk->data, &raw[3], pk->len);
+    }
+    // a reply is never left without its delimiter
+    if (start != n) bad_packets++;
+}
+
+/* the OUTPUT payloads of `seq` joined, then the 32-bit value of its final DONE or ERROR packet */
+static int reply(uint16_t seq, uint8_t *type, char *out, int size) {
+    int len = 0;
+    int32_t value = 0;
+    *type = 0;
+    for (int i = 0; i < n_packets; i++) {
+        const packet_t *pk = &packets[i];
+        if (pk->seq != seq) continue;
+        if (*type != 0) *type = 0xFF; // a packet after the final one
+        if (pk->type == CTSHELL_RPC_OUTPUT && *type == 0 && len + pk->len < size) {
+            memcpy(&out[len], pk->data, pk->len);
+            len += pk->len;
+        } else if ((pk->type == CTSHELL_RPC_DONE || pk->type == CTSHELL_RPC_ERROR) && pk->len == 4) {
+            if (*type == 0) *type = pk->type;
+            value = (int32_t) ((uint32_t) pk->data[0] | (uint32_t) pk->data[1] << 8 |
+                               (uint32_t) pk->data[2] << 16 | (uint32_t) pk->data[3] << 24);
+        } else {
+            *type = 0xFF;
+        }
+    }
+    out[len] = '\0';
+    return value;
+}
+
+static void feed(const char *data, uint16_t len) {
+    ctshell_input_buf(&ctx, data, len);
+    ctshell_poll(&ctx);
+}
+
+static int ends_with(const char *s) {
+    size_t n = strlen(s);
+    return test_output_len() >= n && memcmp(test_output() + test_output_len() - n, s, n) == 0;
+}
+
+int main(void) {
+    test_setup(&ctx);
+
+    // a stray 0x00 on the console stays text
+    feed("\0echo a\r", 8);
+    TEST_CHECK(!ctx.rpc.open && !ctx.rpc_mode);
+    TEST_CHECK(strstr(test_output(), "\r\na\r\n") != NULL && ends_with(CONFIG_CTSHELL_PROMPT));
+
+    // the delimiter after the command's echo marks where text ends
+    test_clear();
+    test_feed(&ctx, "rpc\r");
+    TEST_CHECK(ctx.rpc.open && ctx.rpc_mode);
+    TEST_CHECK(test_output_len() > 0 && test_output()[test_output_len() - 1] == '\0');
+
+    uint8_t type;
+    char out[512];
+    int rc;
+
+    // two requests in one read, answered in order
+    test_clear();
+    frames_len = 0;
+    add_request(CTSHELL_RPC_CALL_NAME, 1, "echo\0a\0", 7);
+    add_request(CTSHELL_RPC_CALL_NAME, 2, "echo\0b\0", 7);
+    feed(frames, (uint16_t) frames_len);
+    decode_output();
+    TEST_CHECK(bad_packets == 0);
+    TEST_CHECK(n_packets == 4 && packets[0].seq == 1 && packets[n_packets - 1].seq == 2);
+    rc = reply(1, &type, out, sizeof(out));
+    TEST_CHECK(type == CTSHELL_RPC_DONE && rc == 0 && strcmp(out, "a\r\n") == 0);
+    rc = reply(2, &type, out, sizeof(out));
+    TEST_CHECK(type == CTSHELL_RPC_DONE && rc == 0 && strcmp(out, "b\r\n") == 0);
+
+    // a command called by the id LIST gives it
+    test_clear();
+    frames_len = 0;
+    add_request(CTSHELL_RPC_LIST, 3, "", 0);
+    feed(frames, (uint16_t) frames_len);
+    decode_output();
+    TEST_CHECK(bad_packets == 0);
+    rc = reply(3, &type, out, sizeof(out));
+    TEST_CHECK(type == CTSHELL_RPC_DONE && rc == 0);
+    char *echo_line = strstr(out, " echo\n");
+    TEST_CHECK(echo_line != NULL);
+    if (echo_line) {
+        while (echo_line > out && echo_line[-1] != '\n') echo_line--;
+        uint16_t id = (uint16_t) strtoul(echo_line, NULL, 10);
+        uint8_t call[8] = {(uint8_t) id, (uint8_t) (id >> 8), 'z', 0};
+
+        test_clear();
+        frames_len = 0;
+        add_request(CTSHELL_RPC_CALL_ID, 4, call, 4);
+        feed(frames, (uint16_t) frames_len);
+        decode_output();
+        TEST_CHECK(bad_packets == 0 && n_packets == 2);
+        rc = reply(4, &type, out, sizeof(out));
+        TEST_CHECK(type == CTSHELL_RPC_DONE && rc == 0 && strcmp(out, "z\r\n") == 0);
+    }
+
+    // an unknown name does not run
+    test_clear();
+    frames_len = 0;
+    add_request(CTSHELL_RPC_CALL_NAME, 5, "nosuch\0", 7);
+    feed(frames, (uint16_t) frames_len);
+    decode_output();
+    TEST_CHECK(bad_packets == 0 && n_packets == 1);
+    rc = reply(5, &type, out, sizeof(out));
+    TEST_CHECK(type == CTSHELL_RPC_ERROR && rc == CTSHELL_RPC_ERR_NOT_FOUND && out[0] == '\0');
+
+    // a terminal typing lines sends packets that never decode
+    for (int i = 0; i < 4; i++) {
+        TEST_CHECK(ctx.rpc.open);
+        feed("\x05junk\0", 6);
+    }
+    TEST_CHECK(!ctx.rpc.open && !ctx.rpc_mode);
+    TEST_CHECK(ends_with("\r\n" CONFIG_CTSHELL_PROMPT));
+
+    // an unfinished packet times out
+    test_feed(&ctx, "rpc\r");
+    test_clear();
+    test_feed(&ctx, "help");
+    TEST_CHECK(ctx.rpc.open);
+    TEST_CHECK(ctshell_next_timeout(&ctx) > 0 && ctshell_next_timeout(&ctx) <= CONFIG_CTSHELL_RPC_TIMEOUT);
+    struct timespec ts = {0, (CONFIG_CTSHELL_RPC_TIMEOUT + 10) * 1000000L};
+    nanosleep(&ts, NULL);
+    TEST_CHECK(ctshell_next_timeout(&ctx) == 0);
+    ctshell_poll(&ctx);
+    TEST_CHECK(!ctx.rpc.open && !ctx.rpc_mode);
+    TEST_CHECK(strcmp(test_output(), "\r\n" CONFIG_CTSHELL_PROMPT) == 0);
+
+    // Ctrl+C is a key again
+    test_clear();
+    test_feed(&ctx, "echo b\x03" "echo c\r");
+    TEST_CHECK(strstr(test_output(), "\r\nc\r\n") != NULL);
+    TEST_CHECK(strstr(test_output(), "echo bc") == NULL);
+
+    return test_result("test_rpc");
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Command statistics: times in microseconds from the cycle counter, and
+ * runs of commands past CTSHELL_STATS_SIZE counted instead of lost.
+ */
+#include "test.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static ctshell_ctx_t ctx;
+
+static uint32_t get_cycles(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) (ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+static int cmd_spin(int argc, char *argv[]) {
+    CTSHELL_UNUSED_PARAM(argc);
+    CTSHELL_UNUSED_PARAM(argv);
+    struct timespec ts = {0, 300000};
+    nanosleep(&ts, NULL);
+    return 0;
+}
+CTSHELL_EXPORT_CMD(spin, cmd_spin, "Sleep 300 us", CTSHELL_ATTR_NONE);
+
+/* the value of column `col` (0 is the name) on the row of `name` */
+static unsigned long column(const char *name, int col) {
+    char key[32];
+    snprintf(key, sizeof(key), "  %s ", name);
+    const char *p = strstr(test_output(), key);
+    if (!p) return (unsigned long) -1;
+    p += strlen(key);
+    unsigned long v = 0;
+    for (int i = 0; i < col; i++) {
+        v = strtoul(p, (char **) &p, 10);
+    }
+    return v;
+}
+
+int main(void) {
+    test_setup(&ctx);
+    ctx.io.get_cycles = get_cycles;
+    ctx.io.cycles_hz = 1000000000u;
+
+    // spin is linked first and has the only entry, the rest are counted
+    test_feed(&ctx, "spin\r");
+    test_feed(&ctx, "spin\r");
+    test_feed(&ctx, "echo a\r");
+    test_clear();
+    test_feed(&ctx, "stats\r");
+    TEST_CHECK(column("spin", 1) == 2);
+    TEST_CHECK(strstr(test_output(), "runs not recorded: 1,") != NULL);
+    // sub-millisecond runs are measured, not rounded to ticks
+    TEST_CHECK(column("spin", 4) >= 300 && column("spin", 4) < 100000);
+    TEST_CHECK(column("spin", 3) >= 300 && column("spin", 3) <= column("spin", 5));
+
+    // the count restarts with the table, `stats -r` itself is the first one
+    test_feed(&ctx, "stats -r\r");
+    test_clear();
+    test_feed(&ctx, "stats\r");
+    TEST_CHECK(column("spin", 1) == (unsigned long) -1);
+    TEST_CHECK(strstr(test_output(), "runs not recorded: 1,") != NULL);
+
+    return test_result("test_stats");
+}
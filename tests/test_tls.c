@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Several shells, each polled from its own thread with CONFIG_CTSHELL_USE_TLS:
+ * ctshell_printf from a command reaches only the write callback of the shell
+ * running it, never the last initialized shell that is the fallback outside
+ * of ctshell_poll. Deinitializing a shell that is not the fallback keeps
+ * it, deinitializing the fallback clears it.
+ */
+#include "test.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define SHELLS 4
+#define LINES  20000
+#define MARKS  8 // letters printed per line
+
+typedef struct {
+    int id;
+    ctshell_ctx_t ctx;
+    pthread_t tid;
+    unsigned marks;
+    unsigned foreign; // bytes written from another thread or naming another shell
+    unsigned wrong_ctx;
+} shell_t;
+
+static shell_t shells[SHELLS];
+static ctshell_ctx_t fallback; // initialized last, never polled
+static unsigned fallback_bytes;
+static pthread_barrier_t ready;
+static __thread shell_t *self;
+
+static void shell_write(const char *str, uint16_t len, void *priv) {
+    shell_t *sh = priv;
+    if (sh != self) {
+        sh->foreign += len;
+        return;
+    }
+    for (uint16_t i = 0; i < len; i++) {
+        if (str[i] < 'A' || str[i] >= 'A' + SHELLS) continue;
+        if (str[i] == 'A' + sh->id) {
+            sh->marks++;
+        } else {
+            sh->foreign++;
+        }
+    }
+}
+
+static void fallback_write(const char *str, uint16_t len, void *priv) {
+    (void) str;
+    (void) priv;
+    __atomic_add_fetch(&fallback_bytes, len, __ATOMIC_RELAXED);
+}
+
+static int cmd_mark(int argc, char *argv[]) {
+    CTSHELL_UNUSED_PARAM(argc);
+    CTSHELL_UNUSED_PARAM(argv);
+    ctshell_ctx_t *ctx = ctshell_current_ctx();
+    if (ctx != &self->ctx) self->wrong_ctx++;
+    for (int i = 0; i < MARKS; i++) {
+        ctshell_printf("%c", 'A' + self->id);
+    }
+    ctshell_printf("\r\n");
+    return 0;
+}
+CTSHELL_EXPORT_CMD(mark, cmd_mark, "Print this shell's letter", CTSHELL_ATTR_NONE);
+
+static void *shell_thread(void *arg) {
+    shell_t *sh = arg;
+    ctshell_io_t io = {.write = shell_write};
+
+    self = sh;
+    ctshell_init(&sh->ctx, io, sh);
+    ctshell_set_echo(&sh->ctx, 0);
+    pthread_barrier_wait(&ready);
+    // the fallback shell is initialized here
+    pthread_barrier_wait(&ready);
+    for (int i = 0; i < LINES; i++) {
+        test_feed(&sh->ctx, "mark\r");
+    }
+    return NULL;
+}
+
+int main(void) {
+    ctshell_io_t io = {.write = fallback_write};
+
+    pthread_barrier_init(&ready, NULL, SHELLS + 1);
+    for (int i = 0; i < SHELLS; i++) {
+        shells[i].id = i;
+        TEST_CHECK(pthread_create(&shells[i].tid, NULL, shell_thread, &shells[i]) == 0);
+    }
+    pthread_barrier_wait(&ready);
+    ctshell_init(&fallback, io, NULL);
+    TEST_CHECK(ctshell_current_ctx() == &fallback);
+    fallback_bytes = 0;
+    pthread_barrier_wait(&ready);
+    for (int i = 0; i < SHELLS; i++) {
+        pthread_join(shells[i].tid, NULL);
+    }
+
+    for (int i = 0; i < SHELLS; i++) {
+        TEST_CHECK(shells[i].marks == LINES * MARKS);
+        TEST_CHECK(shells[i].foreign == 0);
+        TEST_CHECK(shells[i].wrong_ctx == 0);
+    }
+    TEST_CHECK(fallback_bytes == 0);
+
+    ctshell_deinit(&shells[0].ctx);
+    TEST_CHECK(ctshell_current_ctx() == &fallback);
+    ctshell_deinit(&fallback);
+    TEST_CHECK(ctshell_current_ctx() == NULL);
+    return test_result("test_tls");
+}
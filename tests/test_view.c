@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Editing in the middle of a long line costs the terminal a few bytes per
+ * key, whatever the length of the text after the cursor.
+ */
+#include "test.h"
+
+#include <string.h>
+
+// "ESC[@" plus the inserted character, the most any single edit below needs
+#define KEY_BYTES_MAX 4
+
+#define LEFT   "\033[D"
+#define RIGHT  "\033[C"
+#define DELETE "\033[3~"
+#define BACKSPACE "\x7f"
+
+static ctshell_ctx_t ctx;
+static char got[CONFIG_CTSHELL_LINE_BUF_SIZE];
+
+static int cmd_line(int argc, char *argv[]) {
+    snprintf(got, sizeof(got), "%s", argc > 1 ? argv[1] : "");
+    return 0;
+}
+CTSHELL_EXPORT_CMD(line, cmd_line, "Keep its argument", CTSHELL_ATTR_NONE);
+
+/* one key, fails when its redraw is above KEY_BYTES_MAX */
+static void key(const char *seq) {
+    test_clear();
+    test_feed(&ctx, seq);
+    if (test_output_len() > KEY_BYTES_MAX) {
+        fprintf(stderr, "key '%s': %zu bytes\n", seq[0] == '\033' ? seq + 1 : seq, test_output_len());
+    }
+    TEST_CHECK(test_output_len() <= KEY_BYTES_MAX);
+}
+
+int main(void) {
+    char text[101];
+    char want[128];
+
+    test_setup(&ctx);
+    for (int i = 0; i < 100; i++) {
+        text[i] = (char) ('a' + i % 26);
+    }
+    text[100] = '\0';
+    test_feed(&ctx, "line ");
+    test_feed(&ctx, text);
+    for (int i = 0; i < 50; i++) {
+        key(LEFT);
+    }
+
+    for (int i = 0; i < 10; i++) {
+        key("X");
+    }
+    for (int i = 0; i < 3; i++) {
+        key(BACKSPACE);
+    }
+    for (int i = 0; i < 4; i++) {
+        key(DELETE);
+    }
+    for (int i = 0; i < 5; i++) {
+        key(RIGHT);
+    }
+    key("Y");
+
+    // the edits landed where the screen shows them
+    test_feed(&ctx, "\r");
+    snprintf(want, sizeof(want), "%.50sXXXXXXX%.5sY%s", text, text + 54, text + 59);
+    TEST_CHECK(strcmp(got, want) == 0);
+
+    return test_result("test_view");
+}
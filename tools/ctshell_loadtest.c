@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Load client for the POSIX socket server (port/posix/ctshell_posix_server.c).
+ *
+ * Opens `-i` idle sessions, then runs `-c` concurrent sessions that each send
+ * `-n` commands and wait for the prompt after every one. Prints the command
+ * latency distribution and the aggregate rate.
+ *
+ *   cc -O2 -pthread -o ctshell_loadtest tools/ctshell_loadtest.c
+ *   ./ctshell_loadtest -u /tmp/ctshell.sock -c 32 -n 1000 -i 500 -m help
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define TELNET_DONT 254
+#define TELNET_IAC  255
+#define TELNET_ECHO 1
+
+typedef struct {
+    const char *unix_path;
+    int port;
+    int clients;
+    int commands;
+    int idle;
+    int telnet;
+    const char *command;
+    const char *prompt;
+} opts_t;
+
+typedef struct {
+    pthread_t thread;
+    const opts_t *o;
+    uint64_t *lat_ns;
+    int done;
+    int failed;
+} client_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static int connect_server(const opts_t *o) {
+    int fd;
+    if (o->unix_path) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        strncpy(addr.sun_path, o->unix_path, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) goto fail;
+    } else {
+        struct sockaddr_in addr = {
+                .sin_family = AF_INET,
+                .sin_port = htons((uint16_t) o->port),
+                .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        int one = 1;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) goto fail;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if (o->telnet) {
+        // echo locally, so the server only sends command output
+        const char dont_echo[] = {(char) TELNET_IAC, (char) TELNET_DONT, TELNET_ECHO};
+        if (write(fd, dont_echo, sizeof(dont_echo)) != sizeof(dont_echo)) goto fail;
+    }
+    return fd;
+
+fail:
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+/* reads until the received stream ends with the prompt */
+static int wait_prompt(int fd, const char *prompt) {
+    size_t plen = strlen(prompt);
+    char tail[64] = {0};
+    size_t tlen = 0;
+    char buf[4096];
+
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        for (ssize_t i = 0; i < n; i++) {
+            if (tlen == sizeof(tail)) {
+                memmove(tail, tail + 1, sizeof(tail) - 1);
+                tlen--;
+            }
+            tail[tlen++] = buf[i];
+        }
+        if (tlen >= plen && memcmp(tail + tlen - plen, prompt, plen) == 0) return 0;
+    }
+}
+
+static void *client_main(void *arg) {
+    client_t *c = (client_t *) arg;
+    const opts_t *o = c->o;
+    char line[256];
+    int len = snprintf(line, sizeof(line), "%s\r", o->command);
+
+    int fd = connect_server(o);
+    if (fd < 0 || wait_prompt(fd, o->prompt) < 0) {
+        c->failed = 1;
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    for (int i = 0; i < o->commands; i++) {
+        uint64_t t0 = now_ns();
+        if (write(fd, line, len) != len || wait_prompt(fd, o->prompt) < 0) {
+            c->failed = 1;
+            break;
+        }
+        c->lat_ns[c->done++] = now_ns() - t0;
+    }
+    close(fd);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s (-u PATH | -p PORT) [-c CLIENTS] [-n COMMANDS] [-i IDLE]\n"
+            "          [-m COMMAND] [-P PROMPT] [-t]\n"
+            "  -t  the server speaks telnet, ask it not to echo\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+    opts_t o = {.clients = 8, .commands = 1000, .command = "help", .prompt = "ctsh>> "};
+    int opt;
+
+    while ((opt = getopt(argc, argv, "u:p:c:n:i:m:P:th")) != -1) {
+        switch (opt) {
+            case 'u': o.unix_path = optarg; break;
+            case 'p': o.port = atoi(optarg); break;
+            case 'c': o.clients = atoi(optarg); break;
+            case 'n': o.commands = atoi(optarg); break;
+            case 'i': o.idle = atoi(optarg); break;
+            case 'm': o.command = optarg; break;
+            case 'P': o.prompt = optarg; break;
+            case 't': o.telnet = 1; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if ((!o.unix_path && o.port <= 0) || o.clients <= 0 || o.commands <= 0 || strlen(o.prompt) > 64) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    int *idle_fds = calloc(o.idle > 0 ? o.idle : 1, sizeof(int));
+    int idle_open = 0;
+    for (; idle_open < o.idle; idle_open++) {
+        idle_fds[idle_open] = connect_server(&o);
+        if (idle_fds[idle_open] < 0) {
+            fprintf(stderr, "idle session %d: connect failed\n", idle_open);
+            break;
+        }
+    }
+
+    client_t *clients = calloc(o.clients, sizeof(client_t));
+    uint64_t start = now_ns();
+    for (int i = 0; i < o.clients; i++) {
+        clients[i].o = &o;
+        clients[i].lat_ns = calloc(o.commands, sizeof(uint64_t));
+        pthread_create(&clients[i].thread, NULL, client_main, &clients[i]);
+    }
+
+    size_t total = 0;
+    int failed = 0;
+    for (int i = 0; i < o.clients; i++) {
+        pthread_join(clients[i].thread, NULL);
+        total += clients[i].done;
+        failed += clients[i].failed;
+    }
+    double elapsed = (double) (now_ns() - start) / 1e9;
+
+    uint64_t *all = calloc(total ? total : 1, sizeof(uint64_t));
+    size_t k = 0;
+    for (int i = 0; i < o.clients; i++) {
+        memcpy(all + k, clients[i].lat_ns, clients[i].done * sizeof(uint64_t));
+        k += clients[i].done;
+        free(clients[i].lat_ns);
+    }
+    qsort(all, total, sizeof(uint64_t), cmp_u64);
+
+    printf("sessions: %d active, %d idle, %d failed\n", o.clients, idle_open, failed);
+    printf("commands: %zu in %.2f s, %.0f cmd/s\n", total, elapsed, total / elapsed);
+    if (total > 0) {
+        printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+               all[total / 2] / 1e3, all[total * 9 / 10] / 1e3,
+               all[total * 99 / 100] / 1e3, all[total - 1] / 1e3);
+    }
+
+    for (int i = 0; i < idle_open; i++) {
+        close(idle_fds[i]);
+    }
+    free(idle_fds);
+    free(all);
+    free(clients);
+    return failed ? 1 : 0;
+}
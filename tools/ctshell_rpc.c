@@ -0,0 +1,493 @@
+/*
+ * Copyright (c) 2026, MDLZCOOL
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Reference client for the framed RPC mode (CONFIG_CTSHELL_USE_RPC).
+ *
+ * Runs one command and exits with its return code, lists the command ids,
+ * or compares the throughput of pipelined RPC requests with text lines,
+ * either waiting for the prompt or pipelined in quiet mode. Talks to the
+ * POSIX socket server (port/posix/ctshell_posix_server.c, without telnet)
+ * or a serial port.
+ *
+ *   cc -O2 -o ctshell_rpc tools/ctshell_rpc.c
+ *   ./ctshell_rpc -u /tmp/ctshell.sock -- echo hello
+ *   ./ctshell_rpc -d /dev/ttyUSB0 -s 115200 -l
+ *   ./ctshell_rpc -u /tmp/ctshell.sock -b 10000 -w 8 -m "echo hello"
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/* packet types and errors, as in ctshell.h */
+#define RPC_CALL_NAME 0x01
+#define RPC_CALL_ID   0x02
+#define RPC_LIST      0x03
+#define RPC_CLOSE     0x04
+#define RPC_OUTPUT    0x81
+#define RPC_DONE      0x82
+#define RPC_ERROR     0x83
+#define RPC_EVENT     0x84
+
+#define RPC_HDR_LEN   3
+#define RPC_MAX_PKT   4096
+#define RPC_MAX_ARGS  64
+
+static const char *const rpc_errors[] = {
+        "", "bad packet", "unknown packet type", "bad arguments", "command not found",
+};
+
+typedef struct {
+    const char *unix_path;
+    int port;
+    const char *device;
+    int baud;
+    int list;
+    int id;
+    int bench;
+    int window;
+    const char *command;
+    const char *prompt;
+} opts_t;
+
+typedef struct {
+    int fd;
+    uint8_t buf[4096];
+    size_t pos;
+    size_t len;
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+} link_t;
+
+typedef struct {
+    uint8_t type;
+    uint16_t seq;
+    uint8_t data[RPC_MAX_PKT];
+    int len; // payload bytes after the header
+} packet_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/* CRC-16/CCITT-FALSE */
+static uint16_t crc16(const uint8_t *p, size_t len) {
+    uint16_t crc = 0xFFFF;
+    while (len--) {
+        crc ^= (uint16_t) (*p++ << 8);
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x8000) ? (uint16_t) (crc << 1) ^ 0x1021 : (uint16_t) (crc << 1);
+        }
+    }
+    return crc;
+}
+
+static speed_t baud_constant(int baud) {
+    switch (baud) {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default: return 0;
+    }
+}
+
+static int open_link(const opts_t *o) {
+    int fd = -1;
+    if (o->device) {
+        struct termios tio;
+        speed_t speed = baud_constant(o->baud);
+        fd = open(o->device, O_RDWR | O_NOCTTY);
+        if (fd < 0 || !speed || tcgetattr(fd, &tio) < 0) goto fail;
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+        tio.c_cc[VMIN] = 1;
+        tio.c_cc[VTIME] = 0;
+        if (tcsetattr(fd, TCSANOW, &tio) < 0) goto fail;
+    } else if (o->unix_path) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        strncpy(addr.sun_path, o->unix_path, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) goto fail;
+    } else {
+        struct sockaddr_in addr = {
+                .sin_family = AF_INET,
+                .sin_port = htons((uint16_t) o->port),
+                .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        int one = 1;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) goto fail;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+
+fail:
+    perror(o->device ? o->device : o->unix_path ? o->unix_path : "connect");
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+static int link_write(link_t *l, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = write(l->fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t) n;
+        l->tx_bytes += (uint64_t) n;
+    }
+    return 0;
+}
+
+static int link_getc(link_t *l) {
+    if (l->pos == l->len) {
+        ssize_t n;
+        do {
+            n = read(l->fd, l->buf, sizeof(l->buf));
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) return -1;
+        l->pos = 0;
+        l->len = (size_t) n;
+        l->rx_bytes += (uint64_t) n;
+    }
+    return l->buf[l->pos++];
+}
+
+/* COBS-encodes type, seq, payload and CRC, followed by the delimiter */
+static int send_packet(link_t *l, uint8_t type, uint16_t seq, const uint8_t *payload, size_t len) {
+    uint8_t raw[RPC_HDR_LEN + RPC_MAX_PKT + 2];
+    uint8_t enc[sizeof(raw) + sizeof(raw) / 254 + 2];
+    if (len > RPC_MAX_PKT) return -1;
+
+    raw[0] = type;
+    raw[1] = (uint8_t) seq;
+    raw[2] = (uint8_t) (seq >> 8);
+    memcpy(raw + RPC_HDR_LEN, payload, len);
+    len += RPC_HDR_LEN;
+    uint16_t crc = crc16(raw, len);
+    raw[len++] = (uint8_t) crc;
+    raw[len++] = (uint8_t) (crc >> 8);
+
+    size_t out = 0, code_at = out++;
+    uint8_t code = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (raw[i] != 0) {
+            enc[out++] = raw[i];
+            code++;
+        }
+        if (raw[i] == 0 || code == 0xFF) {
+            enc[code_at] = code;
+            code_at = out++;
+            code = 1;
+        }
+    }
+    enc[code_at] = code;
+    enc[out++] = 0;
+    return link_write(l, enc, out);
+}
+
+/* reads up to the next delimiter and decodes it, skipping packets that fail their CRC */
+static int recv_packet(link_t *l, packet_t *pkt) {
+    uint8_t raw[RPC_HDR_LEN + RPC_MAX_PKT + 2];
+    for (;;) {
+        size_t len = 0;
+        int c, left = 0, code = 0, overflow = 0;
+        while ((c = link_getc(l)) > 0) {
+            if (left == 0) {
+                if (code && code != 0xFF) {
+                    if (len < sizeof(raw)) raw[len++] = 0;
+                    else overflow = 1;
+                }
+                code = c;
+                left = c - 1;
+                continue;
+            }
+            left--;
+            if (len < sizeof(raw)) raw[len++] = (uint8_t) c;
+            else overflow = 1;
+        }
+        if (c < 0) return -1;
+        if (!code) continue; // idle fill
+        if (overflow || left || len < RPC_HDR_LEN + 2 ||
+            crc16(raw, len - 2) != (uint16_t) (raw[len - 2] | raw[len - 1] << 8)) {
+            fprintf(stderr, "dropped a corrupt packet\n");
+            continue;
+        }
+        pkt->type = raw[0];
+        pkt->seq = (uint16_t) (raw[1] | raw[2] << 8);
+        pkt->len = (int) len - RPC_HDR_LEN - 2;
+        memcpy(pkt->data, raw + RPC_HDR_LEN, (size_t) pkt->len);
+        return 0;
+    }
+}
+
+static int32_t packet_value(const packet_t *pkt) {
+    if (pkt->len < 4) return 0;
+    return (int32_t) ((uint32_t) pkt->data[0] | (uint32_t) pkt->data[1] << 8 |
+                      (uint32_t) pkt->data[2] << 16 | (uint32_t) pkt->data[3] << 24);
+}
+
+/*
+ * Switches the link to RPC mode with the `rpc` command, Ctrl+C first drops
+ * whatever was typed before. Text sent before the device's delimiter is
+ * dropped.
+ */
+static int rpc_open(link_t *l) {
+    int c;
+    if (link_write(l, "\003rpc\r", 5) < 0) return -1;
+    while ((c = link_getc(l)) > 0) {}
+    return c < 0 ? -1 : 0;
+}
+
+/* one request, output goes to `out` unless NULL; returns the request's status */
+static int rpc_call(link_t *l, uint8_t type, uint16_t seq, const uint8_t *payload, size_t len, FILE *out,
+                    int32_t *rc) {
+    packet_t pkt;
+    if (send_packet(l, type, seq, payload, len) < 0) return -1;
+    for (;;) {
+        if (recv_packet(l, &pkt) < 0) return -1;
+        if (pkt.type == RPC_EVENT) continue;
+        if (pkt.seq != seq) {
+            fprintf(stderr, "reply to request %u while waiting for %u\n", pkt.seq, seq);
+            return -1;
+        }
+        if (pkt.type == RPC_OUTPUT) {
+            if (out) fwrite(pkt.data, 1, (size_t) pkt.len, out);
+        } else if (pkt.type == RPC_DONE) {
+            *rc = packet_value(&pkt);
+            return 0;
+        } else {
+            int32_t err = packet_value(&pkt);
+            fprintf(stderr, "error: %s\n",
+                    err > 0 && err < (int32_t) (sizeof(rpc_errors) / sizeof(rpc_errors[0])) ? rpc_errors[err] : "?");
+            return -1;
+        }
+    }
+}
+
+/* packs words as NUL-terminated strings, returns the payload length */
+static size_t pack_args(uint8_t *buf, size_t size, int argc, char *argv[]) {
+    size_t len = 0;
+    for (int i = 0; i < argc; i++) {
+        size_t n = strlen(argv[i]) + 1;
+        if (len + n > size) return 0;
+        memcpy(buf + len, argv[i], n);
+        len += n;
+    }
+    return len;
+}
+
+static int split_words(char *s, char *argv[], int max) {
+    int argc = 0;
+    for (char *w = strtok(s, " "); w && argc < max; w = strtok(NULL, " ")) {
+        argv[argc++] = w;
+    }
+    return argc;
+}
+
+/* reads until the received stream ends with the prompt */
+static int wait_prompt(link_t *l, const char *prompt) {
+    size_t plen = strlen(prompt);
+    char tail[64] = {0};
+    size_t tlen = 0;
+    int c;
+    while ((c = link_getc(l)) >= 0) {
+        if (tlen == sizeof(tail)) {
+            memmove(tail, tail + 1, sizeof(tail) - 1);
+            tlen--;
+        }
+        tail[tlen++] = (char) c;
+        if (tlen >= plen && memcmp(tail + tlen - plen, prompt, plen) == 0) return 0;
+    }
+    return -1;
+}
+
+static void report(const char *mode, int n, uint64_t ns, const link_t *l, uint64_t rx0, uint64_t tx0) {
+    printf("%-5s %d requests: %.0f req/s, %.1f us/request, %.1f bytes out, %.1f bytes in per request\n",
+           mode, n, n / ((double) ns / 1e9), (double) ns / 1e3 / n,
+           (double) (l->tx_bytes - tx0) / n, (double) (l->rx_bytes - rx0) / n);
+}
+
+/* the same command as text lines, each waiting for the prompt */
+static int bench_text(link_t *l, const opts_t *o) {
+    char line[512];
+    int len = snprintf(line, sizeof(line), "%s\r", o->command);
+    if (len >= (int) sizeof(line) || link_write(l, "\r", 1) < 0 || wait_prompt(l, o->prompt) < 0) return -1;
+
+    uint64_t rx0 = l->rx_bytes, tx0 = l->tx_bytes;
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < o->bench; i++) {
+        if (link_write(l, line, (size_t) len) < 0 || wait_prompt(l, o->prompt) < 0) return -1;
+    }
+    report("text", o->bench, now_ns() - t0, l, rx0, tx0);
+    return 0;
+}
+
+/* reads up to the end marker of a quiet mode line, "\x03<seq> <rc>\r\n" */
+static int wait_quiet_end(link_t *l, int *seq) {
+    char mark[32];
+    size_t n = 0;
+    int c;
+    do {
+        c = link_getc(l);
+    } while (c >= 0 && c != 0x03);
+    while ((c = link_getc(l)) >= 0 && c != '\n') {
+        if (n < sizeof(mark) - 1) mark[n++] = (char) c;
+    }
+    mark[n] = '\0';
+    return c < 0 || sscanf(mark, "%d", seq) != 1 ? -1 : 0;
+}
+
+/* text lines in quiet mode, `window` of them outstanding without waiting for a prompt */
+static int bench_quiet(link_t *l, const opts_t *o) {
+    char line[512];
+    int len = snprintf(line, sizeof(line), "%s\r", o->command);
+    if (len >= (int) sizeof(line) || link_write(l, "quiet on\r", 9) < 0) return -1;
+
+    uint64_t rx0 = l->rx_bytes, tx0 = l->tx_bytes;
+    uint64_t t0 = now_ns();
+    int sent = 0, done = 0, seq;
+    while (done < o->bench) {
+        while (sent < o->bench && sent - done < o->window) {
+            if (link_write(l, line, (size_t) len) < 0) return -1;
+            sent++;
+        }
+        if (wait_quiet_end(l, &seq) < 0) return -1;
+        // numbering starts at 1 when quiet mode is turned on and wraps at 16 bits
+        if (seq != (done + 1) % 0x10000) {
+            fprintf(stderr, "line %d failed\n", done);
+            return -1;
+        }
+        done++;
+    }
+    report("quiet", o->bench, now_ns() - t0, l, rx0, tx0);
+    if (link_write(l, "quiet off\r", 10) < 0 || wait_quiet_end(l, &seq) < 0) return -1;
+    return wait_prompt(l, o->prompt);
+}
+
+/* keeps up to `window` requests outstanding, replies arrive in request order */
+static int bench_rpc(link_t *l, const opts_t *o) {
+    char words[512];
+    char *argv[RPC_MAX_ARGS];
+    uint8_t payload[RPC_MAX_PKT];
+    snprintf(words, sizeof(words), "%s", o->command);
+    int argc = split_words(words, argv, RPC_MAX_ARGS);
+    size_t len = pack_args(payload, sizeof(payload), argc, argv);
+    if (argc == 0 || len == 0) return -1;
+
+    uint64_t rx0 = l->rx_bytes, tx0 = l->tx_bytes;
+    uint64_t t0 = now_ns();
+    int sent = 0, done = 0;
+    packet_t pkt;
+    while (done < o->bench) {
+        while (sent < o->bench && sent - done < o->window) {
+            if (send_packet(l, RPC_CALL_NAME, (uint16_t) sent, payload, len) < 0) return -1;
+            sent++;
+        }
+        if (recv_packet(l, &pkt) < 0) return -1;
+        if (pkt.type == RPC_OUTPUT || pkt.type == RPC_EVENT) continue;
+        if (pkt.type != RPC_DONE || pkt.seq != (uint16_t) done) {
+            fprintf(stderr, "request %d failed\n", done);
+            return -1;
+        }
+        done++;
+    }
+    report("rpc", o->bench, now_ns() - t0, l, rx0, tx0);
+    return 0;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s (-u PATH | -p PORT | -d DEVICE [-s BAUD]) [-i ID] -- COMMAND [ARGS...]\n"
+            "       %s (-u PATH | -p PORT | -d DEVICE [-s BAUD]) -l\n"
+            "       %s (-u PATH | -p PORT | -d DEVICE [-s BAUD]) -b N [-w WINDOW] [-m COMMAND] [-P PROMPT]\n"
+            "  -i  call the command with this id from -l, the words are its arguments\n"
+            "  -b  compare N pipelined requests with N text lines, prompted and in quiet mode\n", argv0, argv0, argv0);
+}
+
+int main(int argc, char *argv[]) {
+    opts_t o = {.baud = 115200, .id = -1, .window = 8, .command = "echo hello", .prompt = "ctsh>> "};
+    int opt;
+
+    while ((opt = getopt(argc, argv, "u:p:d:s:li:b:w:m:P:h")) != -1) {
+        switch (opt) {
+            case 'u': o.unix_path = optarg; break;
+            case 'p': o.port = atoi(optarg); break;
+            case 'd': o.device = optarg; break;
+            case 's': o.baud = atoi(optarg); break;
+            case 'l': o.list = 1; break;
+            case 'i': o.id = atoi(optarg); break;
+            case 'b': o.bench = atoi(optarg); break;
+            case 'w': o.window = atoi(optarg); break;
+            case 'm': o.command = optarg; break;
+            case 'P': o.prompt = optarg; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    int words = argc - optind;
+    if ((!o.unix_path && o.port <= 0 && !o.device) || o.window <= 0 || strlen(o.prompt) > 64 ||
+        (!o.list && !o.bench && words == 0 && o.id < 0) || o.id > 0xFFFF) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    link_t l = {.fd = open_link(&o)};
+    if (l.fd < 0) return 1;
+
+    int status = 0;
+    int32_t rc = 0;
+    uint8_t payload[RPC_MAX_PKT];
+    if (o.bench) {
+        // text first, the prompt is only printed again when RPC mode closes
+        if (bench_text(&l, &o) < 0 || bench_quiet(&l, &o) < 0 || rpc_open(&l) < 0 || bench_rpc(&l, &o) < 0) {
+            status = -1;
+        }
+    } else if (rpc_open(&l) < 0) {
+        status = -1;
+    } else if (o.list) {
+        status = rpc_call(&l, RPC_LIST, 0, NULL, 0, stdout, &rc);
+    } else if (o.id >= 0) {
+        payload[0] = (uint8_t) o.id;
+        payload[1] = (uint8_t) (o.id >> 8);
+        size_t len = pack_args(payload + 2, sizeof(payload) - 2, words, argv + optind);
+        status = (words && !len) ? -1 : rpc_call(&l, RPC_CALL_ID, 0, payload, len + 2, stdout, &rc);
+    } else {
+        size_t len = pack_args(payload, sizeof(payload), words, argv + optind);
+        status = !len ? -1 : rpc_call(&l, RPC_CALL_NAME, 0, payload, len, stdout, &rc);
+    }
+    if (status == 0) {
+        // a serial device would otherwise stay in RPC mode
+        int32_t ignored;
+        rpc_call(&l, RPC_CLOSE, (uint16_t) (o.bench + 1), NULL, 0, NULL, &ignored);
+    }
+    close(l.fd);
+    if (status < 0) {
+        fprintf(stderr, "request failed\n");
+        return 1;
+    }
+    return rc == 0 ? 0 : (rc & 0xFF ? rc & 0xFF : 1);
+}